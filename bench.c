@@ -0,0 +1,404 @@
+// Micro-benchmark for the octaver, update_block().
+//
+// Runs every voice over a set of synthetic whistles and reports the mean cost
+// per sample, the median and 99th percentile cost of a FRAMES_PER_BUFFER
+// block, and how much of the block's real-time deadline the 99th percentile
+// uses.  On Linux, if perf counters are available, it also reports CPU cycles
+// per sample.  It also checks the fast sine against libm, and each
+// waveshaper's table against its math, printing the worst error it finds and,
+// for the shapers, what they cost with and without the table and at each
+// oversampling factor.  Finally it compares how well zero crossings and the
+// pitch detector track a breathy whistle that jumps between notes.
+
+#define _GNU_SOURCE  // M_PI
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#include "oversample.h"
+#include "shaper.h"
+#include "sine.h"
+#include "synth.h"
+
+#define DEFAULT_SECONDS (5)
+#define AMPLITUDE (0.3)
+
+#define SIG_SWEEP 0
+#define SIG_VIBRATO 1
+#define SIG_NOISE 2
+#define SIG_SILENCE 3
+#define N_SIGNALS 4
+
+const char* signal_names[N_SIGNALS] = {"sweep", "vibrato", "noise", "silence"};
+
+
+// Whistles are at 700-2800Hz.  Voices that expect something lower, like
+// singing, get everything shifted down by octaves until it's centered in the
+// range they accept.
+float voice_octave_scale(int v) {
+  float center_hz = sqrtf(voices[v].range_high * voices[v].range_low);
+  return powf(2, roundf(log2f(center_hz / 1400)));
+}
+
+void make_signal(int signal, float* buf, long n, float octave_scale) {
+  uint32_t seed = 12345;
+  double phase = 0;
+  for (long i = 0; i < n; i++) {
+    float t = (float)i / synth_sample_rate();
+    float seconds = (float)n / synth_sample_rate();
+    float hz = 0;
+    if (signal == SIG_SWEEP) {
+      hz = 700 * powf(4, t / seconds);
+    } else if (signal == SIG_VIBRATO) {
+      hz = 1500 * (1 + 0.03 * sinf(2 * M_PI * 6 * t));
+    }
+
+    if (signal == SIG_NOISE) {
+      seed = seed * 1664525 + 1013904223;
+      buf[i] = AMPLITUDE * ((seed >> 8) / 8388608.0f - 1);
+    } else if (signal == SIG_SILENCE) {
+      buf[i] = 0;
+    } else {
+      phase += 2 * M_PI * hz * octave_scale / synth_sample_rate();
+      buf[i] = AMPLITUDE * sin(phase);
+    }
+  }
+}
+
+const char* sine_names[] = {"libm", "table", "poly"};
+
+// Worst error of sine_decimal() and sine_decimal4() against double-precision
+// sin(), over a few cycles either side of zero.
+double sine_error() {
+  double worst = 0;
+  for (int i = 0; i < 1000000; i++) {
+    float v = -4 + 8.0f * i / 1000000;
+    double want = sin((v + 0.5) * M_PI * 2);
+    v4sf v4 = {v, v, v, v};
+    worst = fmax(worst, fabs(sine_decimal(v) - want));
+    worst = fmax(worst, fabs(sine_decimal4(v4)[0] - want));
+  }
+  return worst;
+}
+
+const char* shape_names[N_SHAPES] = {"clip", "fuzz", "soft"};
+
+double now_ns();
+
+// Worst error of the shape's table against its math, over the table's range.
+double shape_error(int shape) {
+  double worst = 0;
+  for (int i = 0; i < 1000000; i++) {
+    float v = -SHAPER_RANGE + 2.0f * SHAPER_RANGE * i / 1000000;
+    float shaped = v;
+    shape_block(shape, &shaped, 1);
+    worst = fmax(worst, fabs(shaped - shape_exact(shape, v)));
+  }
+  return worst;
+}
+
+// ns/sample for the shape at the given oversampling factor, or with the
+// math instead of the table if factor is 0.
+double shape_ns(int shape, int factor, const float* buf, long n) {
+  float block[FRAMES_PER_BUFFER];
+  struct Oversampler os;
+  init_oversampler(&os);
+  double start = now_ns();
+  for (long b = 0; b + FRAMES_PER_BUFFER <= n; b += FRAMES_PER_BUFFER) {
+    for (int i = 0; i < FRAMES_PER_BUFFER; i++) {
+      block[i] = 2 * buf[b + i];
+    }
+    if (factor == 0) {
+      for (int i = 0; i < FRAMES_PER_BUFFER; i++) {
+        block[i] = shape_exact(shape, block[i]);
+      }
+    } else {
+      oversample_shape(&os, factor, shape, block, FRAMES_PER_BUFFER);
+    }
+  }
+  return (now_ns() - start) / n;
+}
+
+double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int open_cycle_counter() {
+#ifdef __linux__
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CPU_CYCLES;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  return -1;
+#endif
+}
+
+int compare_doubles(const void* a, const void* b) {
+  double da = *(const double*)a;
+  double db = *(const double*)b;
+  return (da > db) - (da < db);
+}
+
+void bench(int voice, int signal, const float* buf, long n_blocks,
+           double* block_ns, int cycle_fd) {
+  init_synth();
+  set_params(0, voice, 5, 1);
+
+  // Warm up caches and let the octaver lock on before timing anything.
+  float out[FRAMES_PER_BUFFER];
+  for (int i = 0; i < 64; i++) {
+    update_block(0, buf + (i % n_blocks) * FRAMES_PER_BUFFER, out,
+                 FRAMES_PER_BUFFER);
+  }
+
+  volatile float sink = 0;
+  uint64_t cycles = 0;
+#ifdef __linux__
+  if (cycle_fd >= 0) {
+    ioctl(cycle_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(cycle_fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+#endif
+  double total_ns = 0;
+  for (long b = 0; b < n_blocks; b++) {
+    const float* block = buf + b * FRAMES_PER_BUFFER;
+    double start = now_ns();
+    update_block(0, block, out, FRAMES_PER_BUFFER);
+    block_ns[b] = now_ns() - start;
+    sink += out[FRAMES_PER_BUFFER - 1];
+    total_ns += block_ns[b];
+  }
+#ifdef __linux__
+  if (cycle_fd >= 0) {
+    ioctl(cycle_fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(cycle_fd, &cycles, sizeof(cycles)) != sizeof(cycles)) {
+      cycles = 0;
+    }
+  }
+#endif
+
+  qsort(block_ns, n_blocks, sizeof(double), compare_doubles);
+  long n_samples = n_blocks * FRAMES_PER_BUFFER;
+  double p50 = block_ns[n_blocks / 2];
+  double p99 = block_ns[(n_blocks * 99) / 100];
+  double deadline_ns = 1e9 * FRAMES_PER_BUFFER / synth_sample_rate();
+
+  printf("%-17s %-8s %9.1f %10.2f %10.2f %8.1f%%",
+         voices[voice].name, signal_names[signal],
+         total_ns / n_samples, p50 / 1000, p99 / 1000,
+         100 * p99 / deadline_ns);
+  if (cycles) {
+    printf(" %12.1f", (double)cycles / n_samples);
+  } else {
+    printf(" %12s", "n/a");
+  }
+  printf("\n");
+}
+
+// A breathy whistle: a tone with a strong second harmonic and noise, jumping
+// to a new note every TRACK_NOTE_SECONDS.  period gets the true period of
+// each sample.
+#define TRACK_NOTE_SECONDS (0.25)
+#define TRACK_IN_TUNE_CENTS (50)
+
+void make_breathy(float* buf, float* period, long n, float octave_scale) {
+  const float notes_hz[] = {1047, 1319, 880, 1568, 1175, 784, 1397, 988};
+  const int n_notes = sizeof(notes_hz) / sizeof(notes_hz[0]);
+  long note_samples = TRACK_NOTE_SECONDS * synth_sample_rate();
+  uint32_t seed = 12345;
+  double phase = 0;
+  for (long i = 0; i < n; i++) {
+    float hz = notes_hz[(i / note_samples) % n_notes] * octave_scale;
+    phase += 2 * M_PI * hz / synth_sample_rate();
+    seed = seed * 1664525 + 1013904223;
+    float noise = (seed >> 8) / 8388608.0f - 1;
+    buf[i] = AMPLITUDE * (sin(phase) + 0.5 * sin(2 * phase + 1) +
+                          0.3 * noise);
+    period[i] = synth_sample_rate() / hz;
+  }
+}
+
+int compare_floats(const void* a, const void* b) {
+  float fa = *(const float*)a;
+  float fb = *(const float*)b;
+  return (fa > fb) - (fa < fb);
+}
+
+// How well the octaver's period follows make_breathy()'s, block by block:
+// the share of blocks within TRACK_IN_TUNE_CENTS, the median error, how long
+// after each jump until it's in tune, and what it costs.
+void track(int voice, int method, const float* buf, const float* period,
+           long n_blocks) {
+  int saved_method = voices[voice].pitch;
+  voices[voice].pitch = method;
+  init_synth();
+  set_params(0, voice, 5, 1);
+
+  float out[FRAMES_PER_BUFFER];
+  float* cents = malloc(n_blocks * sizeof(float));
+  long note_blocks =
+    (long)(TRACK_NOTE_SECONDS * synth_sample_rate()) / FRAMES_PER_BUFFER;
+  long in_tune = 0;
+  double latency_blocks = 0;
+  int n_jumps = 0;
+  long jump_block = -1;
+  double start = now_ns();
+  for (long b = 0; b < n_blocks; b++) {
+    update_block(0, buf + b * FRAMES_PER_BUFFER, out, FRAMES_PER_BUFFER);
+    float want = period[(b + 1) * FRAMES_PER_BUFFER - 1];
+    float got = input_period(0);
+    cents[b] = got > 0 ? fabsf(1200 * log2f(got / want)) : 1200;
+    in_tune += cents[b] <= TRACK_IN_TUNE_CENTS;
+
+    if (b > 0 && want != period[b * FRAMES_PER_BUFFER - 1]) {
+      jump_block = b;
+    }
+    if (jump_block >= 0 && cents[b] <= TRACK_IN_TUNE_CENTS) {
+      latency_blocks += b - jump_block + 1;
+      n_jumps++;
+      jump_block = -1;
+    } else if (jump_block >= 0 && b - jump_block >= note_blocks - 1) {
+      latency_blocks += note_blocks;  // never caught up
+      n_jumps++;
+      jump_block = -1;
+    }
+  }
+  double ns = now_ns() - start;
+  qsort(cents, n_blocks, sizeof(float), compare_floats);
+
+  printf("%-17s %-9s %8.1f%% %10.1f %10.2f %10.1f\n",
+         voices[voice].name, method == PITCH_MPM ? "mpm" : "crossings",
+         100.0 * in_tune / n_blocks, cents[n_blocks / 2],
+         n_jumps ? 1000.0 * latency_blocks * FRAMES_PER_BUFFER /
+                   synth_sample_rate() / n_jumps : 0,
+         ns / (n_blocks * FRAMES_PER_BUFFER));
+  free(cents);
+  voices[voice].pitch = saved_method;
+}
+
+int main(int argc, char** argv) {
+  set_delay_enabled(0);  // we only time update_block()
+  while (argc > 2 && strncmp(argv[1], "--", 2) == 0) {
+    if (strcmp(argv[1], "--voices") == 0) {
+      if (!load_voices(argv[2])) {
+        return -1;
+      }
+    } else if (strcmp(argv[1], "--rate") == 0 && atof(argv[2]) > 0) {
+      set_sample_rate(atof(argv[2]));
+    } else {
+      argc = 4;  // print usage
+      break;
+    }
+    argc -= 2;
+    argv += 2;
+  }
+  if (argc > 3) {
+    printf("usage: zeros-bench [--voices file] [--rate hz] [seconds-per-signal [voice]]\n");
+    return -1;
+  }
+  float seconds = argc > 1 ? atof(argv[1]) : DEFAULT_SECONDS;
+  int only_voice = argc > 2 ? atoi(argv[2]) : -1;
+
+  long n_blocks = (long)(seconds * synth_sample_rate()) / FRAMES_PER_BUFFER;
+  if (n_blocks < 100) {
+    printf("need at least %.2fs per signal\n",
+           100.0 * FRAMES_PER_BUFFER / synth_sample_rate());
+    return -1;
+  }
+  long n_samples = n_blocks * FRAMES_PER_BUFFER;
+  float* buf = malloc(n_samples * sizeof(float));
+  double* block_ns = malloc(n_blocks * sizeof(double));
+  if (!buf || !block_ns) {
+    printf("could not allocate signal buffers\n");
+    return -1;
+  }
+
+  int cycle_fd = open_cycle_counter();
+
+  init_sine();
+  printf("sine: %s, max error %.1e\n", sine_names[SINE], sine_error());
+  init_shapers();
+  init_oversampling();
+  make_signal(SIG_NOISE, buf, n_samples, 1);
+  for (int shape = 0; shape < N_SHAPES; shape++) {
+    printf("shaper %s: ", shape_names[shape]);
+    if (shape != SHAPE_CLIP) {
+      printf("max error %.1e, %.1f ns/sample without table, ",
+             shape_error(shape), shape_ns(shape, 0, buf, n_samples));
+    }
+    printf("%.1f/%.1f/%.1f ns/sample at 1x/2x/4x\n",
+           shape_ns(shape, 1, buf, n_samples),
+           shape_ns(shape, 2, buf, n_samples),
+           shape_ns(shape, 4, buf, n_samples));
+  }
+
+  printf("%d-frame blocks, %.2fms deadline per block, %.1fs per signal\n",
+         FRAMES_PER_BUFFER, 1000.0 * FRAMES_PER_BUFFER / synth_sample_rate(),
+         (double)n_samples / synth_sample_rate());
+  printf("%-17s %-8s %9s %10s %10s %9s %12s\n",
+         "voice", "signal", "ns/sample", "p50 us", "p99 us", "p99/dl",
+         "cycles/smpl");
+  for (int v = 0; v < N_VOICES; v++) {
+    if (!voices[v].name[0] || (only_voice >= 0 && v != only_voice)) {
+      continue;
+    }
+    for (int s = 0; s < N_SIGNALS; s++) {
+      make_signal(s, buf, n_samples, voice_octave_scale(v));
+      bench(v, s, buf, n_blocks, block_ns, cycle_fd);
+    }
+  }
+
+  // A supersaw costs more with every OSC_LANES saws, so time the most it
+  // allows too.
+  if (voices[V_SUPERSAW].supersaw.saws &&
+      (only_voice < 0 || only_voice == V_SUPERSAW)) {
+    struct Voice saved = voices[V_SUPERSAW];
+    voices[V_SUPERSAW].supersaw.saws = SUPERSAW_MAX_SAWS;
+    snprintf(voices[V_SUPERSAW].name, sizeof(voices[V_SUPERSAW].name),
+             "%.20s-%d", saved.name, SUPERSAW_MAX_SAWS);
+    for (int s = 0; s < N_SIGNALS; s++) {
+      make_signal(s, buf, n_samples, voice_octave_scale(V_SUPERSAW));
+      bench(V_SUPERSAW, s, buf, n_blocks, block_ns, cycle_fd);
+    }
+    voices[V_SUPERSAW] = saved;
+  }
+
+  printf("tracking a breathy whistle, jumping every %.2fs\n",
+         TRACK_NOTE_SECONDS);
+  printf("%-17s %-9s %9s %10s %10s %10s\n",
+         "voice", "pitch", "in tune", "med cents", "latency ms", "ns/sample");
+  float* period = malloc(n_samples * sizeof(float));
+  int track_voices[] = {V_EBASS, V_VOCAL_1};
+  for (int i = 0; i < 2 && period; i++) {
+    int v = only_voice >= 0 ? only_voice : track_voices[i];
+    make_breathy(buf, period, n_samples, voice_octave_scale(v));
+    track(v, PITCH_CROSSINGS, buf, period, n_blocks);
+    track(v, PITCH_MPM, buf, period, n_blocks);
+    if (only_voice >= 0) {
+      break;
+    }
+  }
+  free(period);
+
+  if (cycle_fd >= 0) {
+    close(cycle_fd);
+  }
+  return 0;
+}
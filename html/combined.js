@@ -1,3 +1,32 @@
+// The synth itself is the same engine as the native whistle synth, compiled
+// to WebAssembly with SIMD (`make html/zeros.wasm`), playing its supersaw
+// voice.  This only moves audio in and out: each render quantum is one call
+// into the engine, over Float32Array views on the module's memory.
+//
+// index.html fetches the module and passes its bytes in processorOptions,
+// since a worklet can't fetch anything itself.  If there are no bytes, or
+// they won't instantiate, this falls back to the original JavaScript
+// supersaw below, a sample at a time and with at most 7 saws.
+
+// The engine works in interleaved frames of two channels: ours on channel 0,
+// and a silent channel 1.
+var CHANNELS = 2;
+
+// The module is standalone, without JavaScript glue, and the engine never
+// does I/O, so whatever system calls it imports can do nothing.
+function stubImports(module) {
+  var imports = {};
+  var needed = WebAssembly.Module.imports(module);
+  for (var i = 0; i < needed.length; i++) {
+    if (needed[i].kind !== 'function') continue;
+    imports[needed[i].module] = imports[needed[i].module] || {};
+    imports[needed[i].module][needed[i].name] = function() { return 0; };
+  }
+  return imports;
+}
+
+// The JavaScript supersaw, for when there's no engine.
+
 function clip(v) {
   return Math.max(-1, Math.min(1, v));
 }
@@ -167,7 +196,7 @@ class SupersawSynth {
     var octave_divisor = Math.pow(2, this.config.octave_shift);
     var center_period = this.smoothed_period * octave_divisor;
     var detune_cents = this.config.detune_cents;
-    var num_voices = this.config.num_voices;
+    var num_voices = Math.min(this.config.num_voices, 7);
     var half = (num_voices - 1) / 2;
 
     // Voice weights: center is loudest, outer voices quieter
@@ -207,49 +236,111 @@ class SupersawSynth {
   }
 }
 
+var VOLUMES = [0.026, 0.039, 0.059, 0.088, 0.132, 0.198, 0.296, 0.444, 0.667, 1.000];
+function getGateSquared(gateValue) {
+  gateValue = Math.max(0, Math.min(9, Math.round(gateValue)));
+  var ratio = VOLUMES[9 - gateValue] / VOLUMES[5];
+  return ratio * ratio;
+}
+
+// Convert the page's config to what SupersawSynth expects.
+function fallbackConfig(data) {
+  var config = Object.assign({}, data);
+
+  config.gate_squared = getGateSquared(data.gate);
+
+  // Convert frequency range to period range (in samples)
+  config.rangeLow = sampleRate / 588;
+  config.rangeHigh = sampleRate / 3150;
+
+  // Convert attack/release from ms to per-sample coefficients
+  var attack_samples = (data.attack_ms / 1000) * sampleRate;
+  var release_samples = (data.release_ms / 1000) * sampleRate;
+  config.attack_coeff = attack_samples > 0 ?
+    1 - Math.exp(-1 / attack_samples) : 1;
+  config.release_coeff = release_samples > 0 ?
+    1 - Math.exp(-1 / release_samples) : 1;
+  return config;
+}
+
 class Synth extends AudioWorkletProcessor {
-  constructor() {
+  constructor(options) {
     super();
-    this.config = null;
-    this.synth = null;
+    this.engine = null;
+    try {
+      this.startEngine(options.processorOptions.wasm);
+    } catch (e) {
+      console.log("zeros.wasm unavailable, using the JavaScript supersaw:", e);
+      this.engine = null;
+    }
+    this.fallback = null;
+
+    this.volume = 0;
     this.port.onmessage = (event) => {
       var data = event.data;
-
-      // Convert frequency range to period range (in samples)
-      data.rangeLow = sampleRate / data.rangeLow;
-      data.rangeHigh = sampleRate / data.rangeHigh;
-
-      // Convert attack/release from ms to per-sample coefficients
-      var attack_samples = (data.attack_ms / 1000) * sampleRate;
-      var release_samples = (data.release_ms / 1000) * sampleRate;
-      data.attack_coeff = attack_samples > 0 ?
-        1 - Math.exp(-1 / attack_samples) : 1;
-      data.release_coeff = release_samples > 0 ?
-        1 - Math.exp(-1 / release_samples) : 1;
-
-      if (this.synth) {
+      this.volume = data.volume;
+      if (this.engine) {
+        this.engine.wasm_configure(
+          data.volume, data.gate, data.num_voices, data.detune_cents,
+          data.octave_shift, data.attack_ms, data.release_ms,
+          data.pitch_smooth);
+      } else if (this.fallback) {
         // Update config without resetting state
-        this.synth.config = data;
+        this.fallback.config = fallbackConfig(data);
       } else {
-        this.synth = new SupersawSynth(data);
+        this.fallback = new SupersawSynth(fallbackConfig(data));
       }
-      this.config = data;
     };
     this.port.postMessage("ready");
   }
 
+  startEngine(wasm) {
+    var module = new WebAssembly.Module(wasm);
+    this.engine = new WebAssembly.Instance(module, stubImports(module)).exports;
+    if (this.engine._initialize) {
+      this.engine._initialize();
+    }
+    // sampleRate is the AudioWorkletGlobalScope's: the context's rate.
+    this.engine.wasm_init(sampleRate);
+
+    // The engine takes at most a quantum at a time, and never allocates, so
+    // these views stay valid.
+    var frames = 128;
+    var memory = this.engine.memory.buffer;
+    this.input = new Float32Array(
+      memory, this.engine.wasm_input(), frames * CHANNELS);
+    this.output = new Float32Array(
+      memory, this.engine.wasm_output(), frames * CHANNELS);
+  }
+
   process(inputs, outputs, parameters) {
     if (!inputs || !inputs[0] || !inputs[0][0]) return true;
-    if (!this.config || !this.synth) return true;
 
-    for (var i = 0; i < outputs[0][0].length; i++) {
-      var val = this.synth.update(inputs[0][0][i]);
-      val *= this.config.volume;
-      val = clip(val);
+    var input = inputs[0][0];
+    var n = input.length;
+    var first = outputs[0][0];
+    if (this.engine) {
+      for (var i = 0; i < n; i++) {
+        this.input[i * CHANNELS] = input[i];
+      }
+      this.engine.wasm_process(n);
+
+      // The engine applies volume itself, before it clips.
+      for (var i = 0; i < n; i++) {
+        first[i] = this.output[i * CHANNELS];
+      }
+    } else if (this.fallback) {
+      for (var i = 0; i < n; i++) {
+        first[i] = clip(this.fallback.update(input[i]) * this.volume);
+      }
+    } else {
+      return true;
+    }
 
-      for (var j = 0; j < outputs.length; j++) {
-        for (var k = 0; k < outputs[0].length; k++) {
-          outputs[j][k][i] = val;
+    for (var j = 0; j < outputs.length; j++) {
+      for (var k = 0; k < outputs[j].length; k++) {
+        if (outputs[j][k] !== first) {
+          outputs[j][k].set(first);
         }
       }
     }
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE  // M_PI
+
+#include <math.h>
+#include <string.h>
+#include "oscbank.h"
+#include "sine.h"
+
+static inline v4sf select4(v4si mask, v4sf a, v4sf b) {
+  return (v4sf)(((v4si)a & mask) | ((v4si)b & ~mask));
+}
+
+// Recount which paths vector j needs, after any of its slots change.
+static void count_lanes(struct OscBank* bank, int j) {
+  bank->n_active[j] = 0;
+  bank->n_sqr[j] = 0;
+  bank->n_sin[j] = 0;
+  bank->n_lfo[j] = 0;
+  for (int l = 0; l < OSC_LANES; l++) {
+    int slot = j * OSC_LANES + l;
+    if (slot >= N_OSCS || !bank->active[slot]) {
+      continue;
+    }
+    bank->n_active[j]++;
+    bank->n_sqr[j] += bank->mode[slot] == OSC_SQR;
+    bank->n_sin[j] += bank->mode[slot] == OSC_SIN;
+    bank->n_lfo[j] += bank->lfo_amplitude[slot] > 0;
+  }
+}
+
+// Leave slot silent, and with state that stays finite however long it runs.
+static void clear_slot(struct OscBank* bank, int slot) {
+  int j = slot / OSC_LANES;
+  int l = slot % OSC_LANES;
+  bank->amp[j][l] = 0;
+  bank->pos[j][l] = 0;
+  bank->samples[j][l] = 0;
+  bank->total_amplitude[j][l] = 0;
+  bank->speed[j][l] = 0;
+  bank->scale[j][l] = 0;
+  bank->rough_input_period[j][l] = 1;
+  bank->attacking[j][l] = 0;
+  bank->is_nat[j][l] = -1;
+  bank->is_sqr[j][l] = 0;
+  bank->is_sin[j][l] = 0;
+  bank->sqr_prev_val[j][l] = 0;
+  bank->sqr_prev_sign[j][l] = 0;
+  bank->sqr_pending[j][l] = 0;
+}
+
+void osc_bank_init(struct OscBank* bank, float sample_rate) {
+  memset(bank, 0, sizeof(*bank));
+  for (int slot = 0; slot < N_OSC_VECS * OSC_LANES; slot++) {
+    clear_slot(bank, slot);
+  }
+  bank->attack = 1 - expf(-1 / (OSC_ATTACK_SECONDS * sample_rate));
+  bank->release = expf(-1 / (OSC_RELEASE_SECONDS * sample_rate));
+}
+
+void osc_bank_start(struct OscBank* bank, int slot, const struct Osc* osc) {
+  int j = slot / OSC_LANES;
+  int l = slot % OSC_LANES;
+
+  bank->amp[j][l] = 0;
+  bank->pos[j][l] = osc->pos;
+  bank->samples[j][l] = 0;
+  bank->total_amplitude[j][l] = 0;
+  bank->speed[j][l] = osc->speed;
+  bank->scale[j][l] = osc->polarity * osc->vol;
+  bank->rough_input_period[j][l] = osc->rough_input_period;
+  bank->attacking[j][l] = -1;
+  bank->is_nat[j][l] = osc->mode == OSC_NAT ? -1 : 0;
+  bank->is_sqr[j][l] = osc->mode == OSC_SQR ? -1 : 0;
+  bank->is_sin[j][l] = osc->mode == OSC_SIN ? -1 : 0;
+  bank->sqr_prev_val[j][l] = 0;
+  bank->sqr_prev_sign[j][l] = 0;
+  bank->sqr_pending[j][l] = 0;
+
+  bank->active[slot] = 1;
+  bank->mode[slot] = osc->mode;
+  bank->duration[slot] = osc->duration;
+  bank->lfo_step[slot] = osc->lfo_step;
+  bank->lfo_amplitude[slot] = osc->lfo_amplitude;
+  bank->lfo_is_volume[slot] = osc->lfo_is_volume;
+
+  count_lanes(bank, j);
+}
+
+void osc_bank_cycle(struct OscBank* bank) {
+  for (int slot = 0; slot < N_OSCS; slot++) {
+    if (!bank->active[slot]) {
+      continue;
+    }
+    int j = slot / OSC_LANES;
+    int l = slot % OSC_LANES;
+    if (bank->duration[slot] > 0) {
+      bank->duration[slot]--;
+    }
+    if (bank->duration[slot] < 1) {
+      bank->attacking[j][l] = 0;
+      if (bank->amp[j][l] < 0.001) {
+        bank->active[slot] = 0;
+        clear_slot(bank, slot);
+        count_lanes(bank, j);
+      }
+    }
+  }
+}
+
+// A square wave of the sign of val, band-limited with polyBLEP, and a
+// sample late.  When the sign flips we estimate where, between the previous
+// sample and this one, val crossed zero, and smooth the step over the two
+// samples either side of that with the usual quadratic residual.
+static inline v4sf blep_square(struct OscBank* bank, int j, v4sf val) {
+  const v4sf one = {1, 1, 1, 1};
+  v4sf sign = select4(val > 0, one, -one);
+  v4sf prev_val = bank->sqr_prev_val[j];
+  v4si flipped = sign != bank->sqr_prev_sign[j];
+  v4sf step = sign - bank->sqr_prev_sign[j];
+  // How far past the previous sample the crossing was, in samples.  Lanes
+  // that didn't flip may divide by zero here, but get masked off; a flip
+  // from exactly zero to zero (only possible on a lane's first sample) can
+  // give NaN, so that counts as a crossing right at the previous sample.
+  v4sf d = prev_val / (prev_val - val);
+  d = select4((d >= 0) & (d <= one), d, one - one);
+  v4sf before = 0.5f * step * (one - d) * (one - d);
+  v4sf after = -0.5f * step * d * d;
+
+  v4sf out = bank->sqr_pending[j] + select4(flipped, before, one - one);
+  bank->sqr_pending[j] = sign + select4(flipped, after, one - one);
+  bank->sqr_prev_sign[j] = sign;
+  bank->sqr_prev_val[j] = val;
+  return out;
+}
+
+// Where in hist's buffer the sample before the one i back is, so the one i
+// back is the next along: 1 is the newest, and 0 is the oldest that's still
+// within HISTORY_LENGTH.
+static inline v4si hist_index(const struct Ring* hist, v4si i, int written) {
+  v4si back = ((i - 1) & (HISTORY_LENGTH - 1)) + 1;
+  return (written - back - 1) & (int)hist->mask;
+}
+
+void osc_bank_run(struct OscBank* bank, const struct Ring* hist,
+                  unsigned int written, int n, float* out) {
+  int vecs[N_OSC_VECS];
+  int n_vecs = 0;
+  for (int j = 0; j < N_OSC_VECS; j++) {
+    if (bank->n_active[j]) {
+      vecs[n_vecs++] = j;
+    }
+  }
+  if (!n_vecs) {
+    return;
+  }
+
+  const v4sf one = {1, 1, 1, 1};
+  const float attack = bank->attack;
+  const float release = bank->release;
+
+  for (int t = 0; t < n; t++) {
+    int now = written + t;
+    v4sf sum = {0, 0, 0, 0};
+
+    for (int k = 0; k < n_vecs; k++) {
+      int j = vecs[k];
+      v4sf pos = bank->pos[j];
+      v4sf amp = bank->amp[j];
+      amp = select4(bank->attacking[j],
+                    amp + attack * (one - amp),
+                    amp * release);
+      bank->amp[j] = amp;
+      v4sf samples = bank->samples[j] + one;
+      bank->samples[j] = samples;
+
+      // We interpolate between the sample pos_a back and the one before it,
+      // which the ring's mirrored tail keeps next to each other.  Except at
+      // lag 0, which is the oldest sample, so the one "before" it wraps
+      // around to the newest.  Positions only grow, so that's only ever an
+      // oscillator's first sample or so.
+      v4si pos_a = __builtin_convertvector(pos, v4si);
+      v4si index = hist_index(hist, pos_a, now);
+      v4sf val_a;
+      v4sf val_b;
+      for (int l = 0; l < OSC_LANES; l++) {
+        val_b[l] = hist->buf[index[l]];
+        val_a[l] = hist->buf[index[l] + 1];
+      }
+      v4sf newest = one * ring_get(hist, now - 1);
+      val_b = select4((pos_a & (HISTORY_LENGTH - 1)) == 0, newest, val_b);
+      v4sf amt_a = pos - __builtin_convertvector(pos_a, v4sf);
+      v4sf val = val_a*amt_a + val_b*(one - amt_a);
+
+      v4sf total_amplitude = bank->total_amplitude[j] +
+        (v4sf)((v4si)val & 0x7fffffff);
+      bank->total_amplitude[j] = total_amplitude;
+
+      if (bank->n_sqr[j] || bank->n_sin[j]) {
+        v4sf shaped = val;
+        if (bank->n_sqr[j]) {
+          shaped = select4(bank->is_sqr[j], blep_square(bank, j, val), shaped);
+        }
+        if (bank->n_sin[j]) {
+          shaped = select4(bank->is_sin[j],
+                           sine_decimal4(pos / bank->rough_input_period[j]),
+                           shaped);
+        }
+        shaped *= total_amplitude / samples;
+        val = select4(bank->is_nat[j], val, shaped);
+      }
+
+      bank->pos[j] = pos + bank->speed[j];
+      val = amp * val * bank->scale[j];
+
+      if (bank->n_lfo[j]) {
+        for (int l = 0; l < OSC_LANES; l++) {
+          int slot = j * OSC_LANES + l;
+          if (!bank->active[slot] || bank->lfo_amplitude[slot] <= 0) {
+            continue;
+          }
+          float lfo_amount =
+            (sine_decimal(bank->lfo_pos[slot])+1)*bank->lfo_amplitude[slot];
+          if (bank->lfo_is_volume[slot]) {
+            val[l] = val[l]*lfo_amount + val[l]*(1-bank->lfo_amplitude[slot]);
+          } else {
+            bank->pos[j][l] += lfo_amount;
+          }
+          bank->lfo_pos[slot] += bank->lfo_step[slot];
+        }
+      }
+
+      sum += val;
+    }
+    out[t] += (sum[0] + sum[1]) + (sum[2] + sum[3]);
+  }
+}
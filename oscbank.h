@@ -0,0 +1,119 @@
+// The octaver's oscillators, stored as a struct of arrays so a whole block of
+// samples can be run across all of them with SIMD.
+//
+// Each oscillator plays back the input history at its own speed, starting
+// from the zero crossing that triggered it.  Oscillators are started and
+// aged one crossing at a time (osc_bank_start(), osc_bank_cycle()); between
+// crossings nothing but their running state changes, so osc_bank_run() can
+// process everything up to the next crossing in one call.
+//
+// We use GCC's vector extensions rather than intrinsics: the same kernel
+// compiles to SSE on x86 and NEON on the Pi, and to plain scalar code
+// anywhere else.
+
+#ifndef OSCBANK_H
+#define OSCBANK_H
+
+#include "ring.h"
+#include "voices.h"
+
+// Crossings each oscillator sounds for before release, unless its voice says
+// otherwise.  There's a layer of slots for each, so a new layer can start on
+// every crossing without cutting off the old ones.
+#define DURATION (3)
+#define MAX_DURATION (9)
+#define N_OSCS (N_OSCS_PER_LAYER*MAX_DURATION)
+
+// How far back oscillators can read, and how much input we keep.  We keep
+// more than we read so a block's worth of new input can be written before
+// the block's oscillators run, without overwriting anything they need.
+#define HISTORY_LENGTH (8192)
+#define HIST_BUFFER_LENGTH (2*HISTORY_LENGTH)  // a power of two, for Ring
+
+// How quickly oscillators fade in after starting, and out after release:
+// the time constants of their one-pole envelopes.
+#define OSC_ATTACK_SECONDS (0.00226)
+#define OSC_RELEASE_SECONDS (0.00044)
+
+#define OSC_LANES (4)
+#define N_OSC_VECS ((N_OSCS + OSC_LANES - 1) / OSC_LANES)
+
+typedef float v4sf __attribute__((vector_size(16)));
+typedef int v4si __attribute__((vector_size(16)));
+
+// One oscillator, as it's set up on a crossing.
+struct Osc {
+  float pos;
+  int duration;  // crossings
+
+  int mode;
+  float speed;
+  float cycle;
+  int mod;
+  float polarity;
+  float vol;
+
+  float lfo_step;  // LFO cycles per sample
+  float lfo_amplitude;
+  char lfo_is_volume;  // either affects volume or speed
+
+  float rough_input_period;
+};
+
+// Slot i is lane i % OSC_LANES of vector i / OSC_LANES.  Inactive slots
+// have vol 0, so they can run along with the active ones and add nothing.
+struct OscBank {
+  v4sf amp[N_OSC_VECS];
+  v4sf pos[N_OSC_VECS];
+  v4sf samples[N_OSC_VECS];
+  v4sf total_amplitude[N_OSC_VECS];
+  v4sf speed[N_OSC_VECS];
+  v4sf scale[N_OSC_VECS];  // polarity * vol
+  v4sf rough_input_period[N_OSC_VECS];
+  v4si attacking[N_OSC_VECS];  // all ones while duration > 0
+  v4si is_nat[N_OSC_VECS];
+  v4si is_sqr[N_OSC_VECS];
+  v4si is_sin[N_OSC_VECS];
+
+  // OSC_SQR is band-limited with polyBLEP, which needs to correct the
+  // sample before each edge, so square lanes run a sample behind.
+  v4sf sqr_prev_val[N_OSC_VECS];  // what the square was taken from
+  v4sf sqr_prev_sign[N_OSC_VECS];
+  v4sf sqr_pending[N_OSC_VECS];  // next output, maybe still to correct
+
+  // Per vector, so the kernel only takes the paths some lane needs.
+  int n_active[N_OSC_VECS];
+  int n_sqr[N_OSC_VECS];
+  int n_sin[N_OSC_VECS];
+  int n_lfo[N_OSC_VECS];
+
+  // The envelopes' per-sample coefficients, at the bank's sample rate.
+  float attack;
+  float release;
+
+  // Per slot, only touched on crossings or by the rare LFO path.
+  char active[N_OSCS];
+  int mode[N_OSCS];
+  int duration[N_OSCS];
+  float lfo_pos[N_OSCS];
+  float lfo_step[N_OSCS];
+  float lfo_amplitude[N_OSCS];
+  char lfo_is_volume[N_OSCS];
+};
+
+void osc_bank_init(struct OscBank* bank, float sample_rate);
+
+// Start slot's oscillator as osc, keeping the slot's LFO phase.
+void osc_bank_start(struct OscBank* bank, int slot, const struct Osc* osc);
+
+// Age every oscillator by one input cycle, releasing and retiring them.
+void osc_bank_cycle(struct OscBank* bank);
+
+// Add n samples of all oscillators into out.  hist is the input history, of
+// at least HIST_BUFFER_LENGTH, and written is how many samples had been written to it
+// as of out[0], counting out[0]'s own input.  The n-1 samples after that
+// must already be written too.
+void osc_bank_run(struct OscBank* bank, const struct Ring* hist,
+                  unsigned int written, int n, float* out);
+
+#endif
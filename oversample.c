@@ -0,0 +1,116 @@
+#define _GNU_SOURCE  // M_PI
+
+#include <math.h>
+#include <string.h>
+#include "oscbank.h"
+#include "oversample.h"
+#include "shaper.h"
+
+#define KAISER_BETA (7.0)  // about 70dB of stopband
+
+// The odd taps, in order.  They're symmetric, so order of application
+// doesn't matter.
+v4sf halfband_taps[HALFBAND_TAPS / OSC_LANES];
+
+double bessel_i0(double x) {
+  double sum = 1;
+  double term = 1;
+  for (int k = 1; k < 50; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+void init_oversampling() {
+  // Kaiser-windowed sinc at a quarter of the (oversampled) rate, with taps
+  // at -(HALFBAND_TAPS-1) ... HALFBAND_TAPS-1.  Scaled so the odd taps sum
+  // to 0.5, which with the centre tap of 0.5 gives exactly unity at DC.
+  double taps[HALFBAND_TAPS];
+  double sum = 0;
+  for (int t = 0; t < HALFBAND_TAPS; t++) {
+    int j = HALFBAND_TAPS - 1 - 2 * t;
+    double r = (double)j / HALFBAND_TAPS;
+    double window = bessel_i0(KAISER_BETA * sqrt(1 - r * r)) /
+      bessel_i0(KAISER_BETA);
+    taps[t] = sin(M_PI * j / 2) / (M_PI * j) * window;
+    sum += taps[t];
+  }
+  for (int t = 0; t < HALFBAND_TAPS; t++) {
+    halfband_taps[t / OSC_LANES][t % OSC_LANES] = taps[t] * 0.5 / sum;
+  }
+}
+
+int oversample_latency(int factor) {
+  // Each step's up and down filters delay by HALFBAND_HALF_TAPS each, at
+  // their own rate, which is 2x the base rate for 4x's inner step.
+  int latency = 0;
+  for (int rate = 1; rate < factor; rate *= 2) {
+    latency += 2 * HALFBAND_HALF_TAPS / rate;
+  }
+  return latency;
+}
+
+void init_oversampler(struct Oversampler* os) {
+  memset(os, 0, sizeof(*os));
+}
+
+static inline float dot_taps(const float* x) {
+  v4sf sum = {0, 0, 0, 0};
+  for (int i = 0; i < HALFBAND_TAPS / OSC_LANES; i++) {
+    v4sf xv;
+    memcpy(&xv, x + i * OSC_LANES, sizeof(xv));
+    sum += halfband_taps[i] * xv;
+  }
+  return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
+
+// n samples in, 2n out.  Even outputs are the input, delayed to line up with
+// the odd ones, which are interpolated.
+void halfband_up(struct Halfband* f, const float* in, float* out, int n) {
+  float x[HALFBAND_TAPS + MAX_OVERSAMPLE / 2 * FRAMES_PER_BUFFER];
+  memcpy(x, f->odd_hist, sizeof(f->odd_hist));
+  memcpy(x + HALFBAND_TAPS, in, n * sizeof(float));
+  for (int i = 0; i < n; i++) {
+    out[2*i] = x[i + HALFBAND_HALF_TAPS];
+    out[2*i + 1] = 2 * dot_taps(x + i + 1);
+  }
+  memcpy(f->odd_hist, x + n, sizeof(f->odd_hist));
+}
+
+// 2n samples in, n out.
+void halfband_down(struct Halfband* f, const float* in, float* out, int n) {
+  float odd[HALFBAND_TAPS + MAX_OVERSAMPLE / 2 * FRAMES_PER_BUFFER];
+  float even[HALFBAND_HALF_TAPS + MAX_OVERSAMPLE / 2 * FRAMES_PER_BUFFER];
+  memcpy(odd, f->odd_hist, sizeof(f->odd_hist));
+  memcpy(even, f->even_hist, sizeof(f->even_hist));
+  for (int i = 0; i < n; i++) {
+    even[HALFBAND_HALF_TAPS + i] = in[2*i];
+    odd[HALFBAND_TAPS + i] = in[2*i + 1];
+  }
+  for (int i = 0; i < n; i++) {
+    out[i] = 0.5f * even[i] + dot_taps(odd + i);
+  }
+  memcpy(f->odd_hist, odd + n, sizeof(f->odd_hist));
+  memcpy(f->even_hist, even + n, sizeof(f->even_hist));
+}
+
+void oversample_shape(struct Oversampler* os, int factor, int shape,
+                      float* buf, int n) {
+  if (factor < 2) {
+    shape_block(shape, buf, n);
+    return;
+  }
+
+  float x2[2 * FRAMES_PER_BUFFER];
+  halfband_up(&os->up[0], buf, x2, n);
+  if (factor < 4) {
+    shape_block(shape, x2, 2 * n);
+  } else {
+    float x4[4 * FRAMES_PER_BUFFER];
+    halfband_up(&os->up[1], x2, x4, 2 * n);
+    shape_block(shape, x4, 4 * n);
+    halfband_down(&os->down[1], x4, x2, 2 * n);
+  }
+  halfband_down(&os->down[0], x2, buf, n);
+}
@@ -0,0 +1,43 @@
+// Oversampling for the saturation stage, so shaping doesn't alias.
+//
+// Each 2x step is a half-band FIR: every other tap is zero apart from the
+// centre, so upsampling and downsampling each split into two phases and
+// only the odd taps cost anything.  4x is two 2x steps.  Upsampling and
+// downsampling each delay by HALFBAND_HALF_TAPS samples at the rate they
+// take in, so 2x adds 24 samples of latency and 4x, whose inner step runs at
+// twice the rate, 36; oversample_latency() has the figure.
+
+#ifndef OVERSAMPLE_H
+#define OVERSAMPLE_H
+
+#include "synth.h"
+
+#define HALFBAND_HALF_TAPS (12)
+#define HALFBAND_TAPS (2 * HALFBAND_HALF_TAPS)  // non-zero, off-centre
+#define MAX_OVERSAMPLE (4)
+
+// Input the filter still needs from previous blocks.
+struct Halfband {
+  float odd_hist[HALFBAND_TAPS];
+  float even_hist[HALFBAND_HALF_TAPS];  // only used downsampling
+};
+
+struct Oversampler {
+  struct Halfband up[2];
+  struct Halfband down[2];
+};
+
+// Call once, before oversample_shape().
+void init_oversampling();
+
+void init_oversampler(struct Oversampler* os);
+
+// How many samples oversample_shape() delays its input by at factor.
+int oversample_latency(int factor);
+
+// Shape n samples in place, at factor (1, 2, or 4) times the sample rate.
+// n is at most FRAMES_PER_BUFFER.
+void oversample_shape(struct Oversampler* os, int factor, int shape,
+                      float* buf, int n);
+
+#endif
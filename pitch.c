@@ -0,0 +1,213 @@
+#define _GNU_SOURCE  // M_PI
+
+#include <math.h>
+#include <string.h>
+#include "oscbank.h"
+#include "pitch.h"
+
+// A key maximum needs at least this fraction of the highest one to count,
+// and the one we pick needs at least this clarity to be a pitch at all.
+#define MPM_K (0.9)
+#define MPM_MIN_CLARITY (0.7)
+
+#define POWER_FLOOR (1e-20f)
+
+// exp(-2*pi*i*k/len) for k < len/2, for each power of two len up to
+// PITCH_MAX_FFT, stored from index len/2 on so each stage's are contiguous.
+float twiddle_re[PITCH_MAX_FFT];
+float twiddle_im[PITCH_MAX_FFT];
+
+void init_pitch() {
+  for (int half = 1; half < PITCH_MAX_FFT; half *= 2) {
+    for (int k = 0; k < half; k++) {
+      twiddle_re[half + k] = cos(M_PI*k/half);
+      twiddle_im[half + k] = -sin(M_PI*k/half);
+    }
+  }
+}
+
+// We only need the FFT for autocorrelation: transform, take the power of
+// each bin, and transform back.  The power doesn't care what order the bins
+// are in, so the forward transform decimates in frequency and leaves them
+// bit-reversed, and the inverse decimates in time and takes them that way,
+// and neither needs a reordering pass.  n is a power of two, at most
+// PITCH_MAX_FFT.
+//
+// Butterflies are done OSC_LANES at a time wherever a stage's halves are at
+// least that long, which is all but the last couple of stages.
+
+static inline v4sf load4(const float* p) {
+  v4sf v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline void store4(float* p, v4sf v) {
+  memcpy(p, &v, sizeof(v));
+}
+
+static void fft_forward(float* re, float* im, int n) {
+  for (int half = n / 2; half >= 1; half /= 2) {
+    const float* w_re = &twiddle_re[half];
+    const float* w_im = &twiddle_im[half];
+    for (int start = 0; start < n; start += 2*half) {
+      float* a_re = &re[start];
+      float* a_im = &im[start];
+      float* b_re = &re[start + half];
+      float* b_im = &im[start + half];
+      int k = 0;
+      for (; k + OSC_LANES <= half; k += OSC_LANES) {
+        v4sf ar = load4(a_re + k), ai = load4(a_im + k);
+        v4sf br = load4(b_re + k), bi = load4(b_im + k);
+        v4sf wr = load4(w_re + k), wi = load4(w_im + k);
+        v4sf dr = ar - br, di = ai - bi;
+        store4(a_re + k, ar + br);
+        store4(a_im + k, ai + bi);
+        store4(b_re + k, dr*wr - di*wi);
+        store4(b_im + k, dr*wi + di*wr);
+      }
+      for (; k < half; k++) {
+        float d_re = a_re[k] - b_re[k];
+        float d_im = a_im[k] - b_im[k];
+        a_re[k] += b_re[k];
+        a_im[k] += b_im[k];
+        b_re[k] = d_re*w_re[k] - d_im*w_im[k];
+        b_im[k] = d_re*w_im[k] + d_im*w_re[k];
+      }
+    }
+  }
+}
+
+// Unscaled: the result is n times the inverse.
+static void fft_inverse(float* re, float* im, int n) {
+  for (int half = 1; half < n; half *= 2) {
+    const float* w_re = &twiddle_re[half];
+    const float* w_im = &twiddle_im[half];
+    for (int start = 0; start < n; start += 2*half) {
+      float* a_re = &re[start];
+      float* a_im = &im[start];
+      float* b_re = &re[start + half];
+      float* b_im = &im[start + half];
+      // b times the conjugate twiddle.
+      int k = 0;
+      for (; k + OSC_LANES <= half; k += OSC_LANES) {
+        v4sf ar = load4(a_re + k), ai = load4(a_im + k);
+        v4sf br = load4(b_re + k), bi = load4(b_im + k);
+        v4sf wr = load4(w_re + k), wi = load4(w_im + k);
+        v4sf tr = br*wr + bi*wi, ti = bi*wr - br*wi;
+        store4(b_re + k, ar - tr);
+        store4(b_im + k, ai - ti);
+        store4(a_re + k, ar + tr);
+        store4(a_im + k, ai + ti);
+      }
+      for (; k < half; k++) {
+        float t_re = b_re[k]*w_re[k] + b_im[k]*w_im[k];
+        float t_im = b_im[k]*w_re[k] - b_re[k]*w_im[k];
+        b_re[k] = a_re[k] - t_re;
+        b_im[k] = a_im[k] - t_im;
+        a_re[k] += t_re;
+        a_im[k] += t_im;
+      }
+    }
+  }
+}
+
+void pitch_reset(struct PitchDetector* p) {
+  p->period = 0;
+  p->clarity = 0;
+}
+
+void pitch_update(struct PitchDetector* p, const struct Ring* hist,
+                  int max_period) {
+  if (max_period > PITCH_MAX_PERIOD) {
+    max_period = PITCH_MAX_PERIOD;
+  }
+  int w = 2*max_period;
+  // Long enough that lags up to max_period + 1 don't wrap around.
+  int n = 1;
+  while (n < w + max_period + 2) {
+    n *= 2;
+  }
+
+  unsigned int start = hist->written - w;
+  for (int i = 0; i < w; i++) {
+    p->x[i] = ring_get(hist, start + i);
+  }
+
+  // Autocorrelation: the inverse FFT of the power spectrum.
+  float* re = p->fft_re;
+  float* im = p->fft_im;
+  for (int i = 0; i < n; i++) {
+    re[i] = i < w ? p->x[i] : 0;
+    im[i] = 0;
+  }
+  fft_forward(re, im, n);
+  for (int i = 0; i < n; i++) {
+    // The floor only adds to lag 0, negligibly, but keeps the inverse out
+    // of denormals, which are very slow on x86.
+    re[i] = re[i]*re[i] + im[i]*im[i] + POWER_FLOOR;
+    im[i] = 0;
+  }
+  fft_inverse(re, im, n);
+
+  // Normalize: the NSDF is 2r(t)/m(t), where m(t) is the energy of the two
+  // overlapping pieces, which we update from m(0) = 2r(0) as t grows.  It's
+  // 1 for a perfect repeat, and stored over the autocorrelation.
+  float m = 2 * re[0] / n;
+  if (m <= 0) {
+    pitch_reset(p);
+    return;
+  }
+  for (int t = 0; t <= max_period + 1; t++) {
+    if (t > 0) {
+      m -= p->x[t-1]*p->x[t-1] + p->x[w-t]*p->x[w-t];
+    }
+    re[t] = m > 0 ? 2 * (re[t] / n) / m : 0;
+  }
+#define NSDF(t) (re[t])
+
+  // The key maxima are the highest points of each positive lobe after the
+  // one at lag 0.  The period is the first within MPM_K of the highest,
+  // which avoids picking a multiple of it.
+  int t = 1;
+  while (t <= max_period && NSDF(t) > 0) {
+    t++;
+  }
+  int first = t;
+  float highest = 0;
+  for (; t <= max_period; t++) {
+    highest = fmaxf(highest, NSDF(t));
+  }
+
+  int best = 0;
+  for (t = first; t <= max_period && !best; ) {
+    while (t <= max_period && NSDF(t) <= 0) {
+      t++;
+    }
+    int peak = t;
+    while (t <= max_period && NSDF(t) > 0) {
+      if (NSDF(t) > NSDF(peak)) {
+        peak = t;
+      }
+      t++;
+    }
+    if (peak <= max_period && NSDF(peak) >= MPM_K * highest) {
+      best = peak;
+    }
+  }
+  if (!best || NSDF(best) < MPM_MIN_CLARITY) {
+    pitch_reset(p);
+    return;
+  }
+
+  // Fit a parabola through the peak and its neighbours, for a fractional
+  // period.
+  float a = NSDF(best - 1);
+  float b = NSDF(best);
+  float c = NSDF(best + 1);
+  float curve = a - 2*b + c;
+  float shift = curve < 0 ? 0.5f * (a - c) / curve : 0;
+  p->period = best + shift;
+  p->clarity = b - 0.25f * (a - c) * shift;
+#undef NSDF
+}
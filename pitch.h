@@ -0,0 +1,46 @@
+// An alternative to timing zero crossings for finding the input's period:
+// the McLeod pitch method (MPM), which takes the first strong peak of the
+// normalized autocorrelation of the last two longest periods of input.
+// Breath noise and strong harmonics add extra zero crossings, but barely
+// move that peak.
+//
+// The autocorrelation comes from an FFT pair, so each update costs
+// O(N log N) for N a little over three times the longest period.  For the
+// whistle voices that's a 256-point FFT per block.
+//
+// The octaver still starts oscillators on zero crossings, since that keeps
+// them in phase with the input.  With PITCH_MPM it takes the period from
+// here instead, and ignores crossings that come too soon after the last one
+// to be a new cycle.  Estimates trail the input by half the window, which
+// is one longest period, plus up to a block.
+
+#ifndef PITCH_H
+#define PITCH_H
+
+#include "ring.h"
+
+#define PITCH_MAX_PERIOD (1024)  // samples; lower range_lows are cut to this
+#define PITCH_MAX_WINDOW (2*PITCH_MAX_PERIOD)
+#define PITCH_MAX_FFT (4*PITCH_MAX_PERIOD)
+
+struct PitchDetector {
+  float period;  // in samples, or 0 if the input isn't clearly pitched
+  float clarity;  // the normalized autocorrelation there, at most 1
+
+  // Scratch, kept here to stay off the audio thread's stack.
+  float x[PITCH_MAX_WINDOW];
+  float fft_re[PITCH_MAX_FFT];
+  float fft_im[PITCH_MAX_FFT];
+};
+
+// Call once, before pitch_update().
+void init_pitch();
+
+void pitch_reset(struct PitchDetector* p);
+
+// Re-estimate the period from the newest input in hist, looking for periods
+// up to max_period samples.
+void pitch_update(struct PitchDetector* p, const struct Ring* hist,
+                  int max_period);
+
+#endif
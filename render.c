@@ -0,0 +1,235 @@
+// Offline renderer: runs a WAV file through the same signal chain zeros.c
+// uses live, as fast as the CPU allows, and writes the result to another WAV.
+//
+// Input is 16/24/32-bit PCM or 32-bit float, mono or stereo, at any rate,
+// which the synth runs at too.  As with the live synth, channel 0 is the
+// whistle and channel 1 feeds the delay; mono input leaves the delay channel
+// silent.  Output is stereo 32-bit float, at the input's rate.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "synth.h"
+
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+void die(char *errmsg) {
+  printf("%s\n",errmsg);
+  exit(-1);
+}
+
+uint32_t read_u32(const unsigned char* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint16_t read_u16(const unsigned char* p) {
+  return p[0] | (p[1] << 8);
+}
+
+void write_u32(FILE* f, uint32_t v) {
+  unsigned char b[4] = {v, v >> 8, v >> 16, v >> 24};
+  fwrite(b, 1, 4, f);
+}
+
+void write_u16(FILE* f, uint16_t v) {
+  unsigned char b[2] = {v, v >> 8};
+  fwrite(b, 1, 2, f);
+}
+
+float decode_sample(const unsigned char* p, int format, int bits) {
+  if (format == WAVE_FORMAT_IEEE_FLOAT) {
+    float f;
+    memcpy(&f, p, 4);
+    return f;
+  }
+  if (bits == 16) {
+    return (int16_t)read_u16(p) / 32768.0f;
+  }
+  if (bits == 24) {
+    int32_t v = (int32_t)((p[0] << 8) | (p[1] << 16) | ((uint32_t)p[2] << 24));
+    return (v >> 8) / 8388608.0f;
+  }
+  return (int32_t)read_u32(p) / 2147483648.0f;
+}
+
+// Reads the whole file into an interleaved stereo buffer, and sets the
+// synth's rate to the file's.  Returns the number of frames.
+long read_wav(const char* fname, float** samples_out, int* channels_out) {
+  FILE* f = fopen(fname, "rb");
+  if (!f) {
+    perror("can't open input");
+    exit(-1);
+  }
+
+  unsigned char header[12];
+  if (fread(header, 1, 12, f) != 12 ||
+      memcmp(header, "RIFF", 4) != 0 ||
+      memcmp(header + 8, "WAVE", 4) != 0) {
+    die("input is not a WAV file");
+  }
+
+  int format = 0;
+  int channels = 0;
+  int bits = 0;
+  long frames = -1;
+  float* samples = NULL;
+
+  unsigned char chunk[8];
+  while (fread(chunk, 1, 8, f) == 8) {
+    uint32_t chunk_size = read_u32(chunk + 4);
+    if (memcmp(chunk, "fmt ", 4) == 0) {
+      unsigned char fmt[40];
+      uint32_t n = chunk_size < sizeof(fmt) ? chunk_size : sizeof(fmt);
+      if (n < 16 || fread(fmt, 1, n, f) != n) {
+        die("bad fmt chunk");
+      }
+      fseek(f, chunk_size - n, SEEK_CUR);
+      format = read_u16(fmt);
+      channels = read_u16(fmt + 2);
+      bits = read_u16(fmt + 14);
+      if (format == WAVE_FORMAT_EXTENSIBLE && n >= 26) {
+        format = read_u16(fmt + 24);
+      }
+      if (read_u32(fmt + 4) == 0) {
+        die("input has no sample rate");
+      }
+      set_sample_rate(read_u32(fmt + 4));
+      if (channels < 1 || channels > 2) {
+        die("input must be mono or stereo");
+      }
+      if (!(format == WAVE_FORMAT_PCM &&
+            (bits == 16 || bits == 24 || bits == 32)) &&
+          !(format == WAVE_FORMAT_IEEE_FLOAT && bits == 32)) {
+        die("input must be 16/24/32-bit PCM or 32-bit float");
+      }
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      if (!channels) {
+        die("data chunk before fmt chunk");
+      }
+      int bytes_per_frame = channels * bits / 8;
+      frames = chunk_size / bytes_per_frame;
+      unsigned char* raw = malloc(chunk_size);
+      samples = malloc(frames * 2 * sizeof(float));
+      if (!raw || !samples) {
+        die("input too large");
+      }
+      frames = fread(raw, 1, chunk_size, f) / bytes_per_frame;
+      for (long i = 0; i < frames; i++) {
+        const unsigned char* p = raw + i * bytes_per_frame;
+        samples[i*2] = decode_sample(p, format, bits);
+        samples[i*2 + 1] = channels == 2 ?
+          decode_sample(p + bits / 8, format, bits) : 0;
+      }
+      free(raw);
+      break;
+    } else {
+      fseek(f, chunk_size + (chunk_size & 1), SEEK_CUR);
+    }
+  }
+  fclose(f);
+
+  if (frames < 0) {
+    die("no data chunk in input");
+  }
+  *samples_out = samples;
+  *channels_out = channels;
+  return frames;
+}
+
+void write_wav(const char* fname, const float* samples, long frames) {
+  FILE* f = fopen(fname, "wb");
+  if (!f) {
+    perror("can't open output");
+    exit(-1);
+  }
+  uint32_t data_size = frames * 2 * sizeof(float);
+  fwrite("RIFF", 1, 4, f);
+  write_u32(f, 4 + (8 + 16) + (8 + data_size));
+  fwrite("WAVE", 1, 4, f);
+  fwrite("fmt ", 1, 4, f);
+  write_u32(f, 16);
+  write_u16(f, WAVE_FORMAT_IEEE_FLOAT);
+  write_u16(f, 2);
+  uint32_t rate = synth_sample_rate();
+  write_u32(f, rate);
+  write_u32(f, rate * 2 * sizeof(float));
+  write_u16(f, 2 * sizeof(float));
+  write_u16(f, 32);
+  fwrite("data", 1, 4, f);
+  write_u32(f, data_size);
+  // Float WAV is little-endian, as are all the machines we run on.
+  fwrite(samples, sizeof(float), frames * 2, f);
+  fclose(f);
+}
+
+double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 2 && strcmp(argv[1], "--voices") == 0) {
+    if (!load_voices(argv[2])) {
+      return -1;
+    }
+    argc -= 2;
+    argv += 2;
+  }
+  if (argc < 3 || argc > 6) {
+    printf("usage: zeros-render [--voices file] in.wav out.wav [voice [volume [gate]]]\n");
+    return -1;
+  }
+  int voice = argc > 3 ? atoi(argv[3]) : V_EBASS;
+  int volume = argc > 4 ? atoi(argv[4]) : 5;
+  int gate = argc > 5 ? atoi(argv[5]) : 1;
+  if (voice < 0 || voice >= N_VOICES || !voices[voice].name[0]) {
+    die("no such voice");
+  }
+  if (volume < 0 || volume > 9 || gate < 0 || gate > 9) {
+    die("volume and gate must each be 0-9");
+  }
+
+  float* in;
+  int channels;
+  long frames = read_wav(argv[1], &in, &channels);
+  // Pad to a whole number of buffers, so we process exactly as live would.
+  long padded = ((frames + FRAMES_PER_BUFFER - 1) / FRAMES_PER_BUFFER) *
+    FRAMES_PER_BUFFER;
+  in = realloc(in, padded * 2 * sizeof(float));
+  float* out = malloc(padded * 2 * sizeof(float));
+  if (!in || !out) {
+    die("could not allocate buffers");
+  }
+  memset(in + frames * 2, 0, (padded - frames) * 2 * sizeof(float));
+
+  // Mono input has nothing for the delay, so don't spend time on it.
+  set_delay_enabled(channels == 2);
+  init_synth();
+  set_params(0, voice, volume, gate);
+
+  double start = now_seconds();
+  for (long i = 0; i < padded; i += FRAMES_PER_BUFFER) {
+    process_frames(in + i * 2, out + i * 2, FRAMES_PER_BUFFER);
+  }
+  double elapsed = now_seconds() - start;
+
+  write_wav(argv[2], out, frames);
+
+  double audio_seconds = (double)frames / synth_sample_rate();
+  printf("voice %d (%s): rendered %.2fs of audio in %.3fs, %.1fx real time, "
+         "%.1f ns/sample\n",
+         voice, voices[voice].name, audio_seconds, elapsed,
+         elapsed > 0 ? audio_seconds / elapsed : 0,
+         padded > 0 ? elapsed * 1e9 / padded : 0);
+
+  free(in);
+  free(out);
+  return 0;
+}
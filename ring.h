@@ -0,0 +1,64 @@
+// A power-of-two ring buffer of floats, for history that's read back at
+// arbitrary delays.
+//
+// Positions are absolute: written counts every sample ever written, and
+// sample p is at buf[p & mask] for as long as it's still in the ring.  The
+// first RING_TAIL entries are mirrored past the end, so the RING_TAIL + 1
+// samples from any position on are contiguous in memory.  That means
+// interpolating between a sample and the next never has to wrap, and a block
+// can be read straight out of the buffer with vector loads.
+
+#ifndef RING_H
+#define RING_H
+
+#include <string.h>
+
+#define RING_TAIL (256)  // longest block we read at once, less one
+
+// How many floats of storage a ring of length samples needs.
+#define RING_STORAGE(length) ((length) + RING_TAIL)
+
+struct Ring {
+  float* buf;  // RING_STORAGE(mask + 1) floats
+  unsigned int mask;
+  unsigned int written;  // samples written, ever
+};
+
+// Set up ring over storage, of RING_STORAGE(length) floats, and fill it with
+// silence.  length must be a power of two, at least RING_TAIL.
+static inline void ring_init(struct Ring* ring, float* storage,
+                             unsigned int length) {
+  memset(storage, 0, RING_STORAGE(length) * sizeof(float));
+  ring->buf = storage;
+  ring->mask = length - 1;
+  ring->written = 0;
+}
+
+static inline void ring_write(struct Ring* ring, float s) {
+  unsigned int i = ring->written & ring->mask;
+  ring->buf[i] = s;
+  if (i < RING_TAIL) {
+    ring->buf[i + ring->mask + 1] = s;
+  }
+  ring->written++;
+}
+
+static inline void ring_write_block(struct Ring* ring, const float* in,
+                                    int n) {
+  for (int i = 0; i < n; i++) {
+    ring_write(ring, in[i]);
+  }
+}
+
+// The sample written at position pos.
+static inline float ring_get(const struct Ring* ring, unsigned int pos) {
+  return ring->buf[pos & ring->mask];
+}
+
+// Samples pos through pos + RING_TAIL, contiguously.
+static inline const float* ring_span(const struct Ring* ring,
+                                     unsigned int pos) {
+  return &ring->buf[pos & ring->mask];
+}
+
+#endif
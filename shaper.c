@@ -0,0 +1,73 @@
+#define _GNU_SOURCE  // M_PI
+
+#include <math.h>
+#include "shaper.h"
+#include "sine.h"
+
+float atan_decimal(float v) {
+  return atanf(v) / (M_PI/2);
+}
+
+#define SAT_1 1
+#define SAT_2 1
+#define SAT_4 1
+#define SAT_8 1
+#define SAT_BIAS 0.5
+
+float fuzz(float v) {
+  float c = sine_decimal(atan_decimal(v * 4));
+  v += (SAT_1 * c);
+  v += (SAT_2 * c*c);
+  v += (SAT_4 * c*c*c*c);
+  v += (SAT_8 * c*c*c*c*c*c*c);
+  v -= SAT_BIAS;
+  v *= 0.55;
+  return atan_decimal(v/4);
+}
+
+float soft(float v) {
+  return tanhf(v);
+}
+
+float (*shape_curves[N_SHAPES])(float) = {
+  [SHAPE_CLIP] = clip,
+  [SHAPE_FUZZ] = fuzz,
+  [SHAPE_SOFT] = soft,
+};
+
+// One extra entry so interpolating the last step doesn't read past the end.
+float shape_tables[N_SHAPES][SHAPER_TABLE_LENGTH + 1];
+
+void init_shapers() {
+  for (int shape = 0; shape < N_SHAPES; shape++) {
+    for (int i = 0; i <= SHAPER_TABLE_LENGTH; i++) {
+      shape_tables[shape][i] = shape_curves[shape](
+        (float)i / SHAPER_STEPS_PER_UNIT - SHAPER_RANGE);
+    }
+  }
+}
+
+float shape_exact(int shape, float v) {
+  return shape_curves[shape](v);
+}
+
+void shape_block(int shape, float* buf, int n) {
+  if (shape == SHAPE_CLIP) {
+    for (int i = 0; i < n; i++) {
+      buf[i] = clip(buf[i]);
+    }
+    return;
+  }
+
+  const float* table = shape_tables[shape];
+  for (int i = 0; i < n; i++) {
+    float x = (buf[i] + SHAPER_RANGE) * SHAPER_STEPS_PER_UNIT;
+    if (!(x >= 0 && x < SHAPER_TABLE_LENGTH)) {
+      buf[i] = shape_curves[shape](buf[i]);
+      continue;
+    }
+    int index = (int)x;
+    float frac = x - index;
+    buf[i] = table[index] + frac * (table[index + 1] - table[index]);
+  }
+}
@@ -0,0 +1,33 @@
+// Waveshapers for the saturation stage.  Each voice picks one with its
+// distort setting (SHAPE_* in voices.h).
+//
+// Apart from SHAPE_CLIP, shapes are pure functions of one sample, so rather
+// than run their math per sample we tabulate them at startup over
+// [-SHAPER_RANGE, SHAPER_RANGE] and interpolate linearly.  Samples outside
+// that, which in practice don't happen, fall back to the math.  A new shape
+// is a new curve function and a line in shaper.c.
+
+#ifndef SHAPER_H
+#define SHAPER_H
+
+#include <math.h>
+#include "voices.h"
+
+#define SHAPER_RANGE (4)
+#define SHAPER_STEPS_PER_UNIT (512)  // fuzz is within 1e-4 of its math at 512
+#define SHAPER_TABLE_LENGTH (2 * SHAPER_RANGE * SHAPER_STEPS_PER_UNIT)
+
+static inline float clip(float v) {
+  return fmaxf(-1, fminf(1, v));
+}
+
+// Call once, before shape_block().
+void init_shapers();
+
+// Apply shape to n samples in place.
+void shape_block(int shape, float* buf, int n);
+
+// The shape's curve, computed directly rather than from its table.
+float shape_exact(int shape, float v);
+
+#endif
@@ -0,0 +1,12 @@
+#define _GNU_SOURCE  // M_PI
+
+#include <math.h>
+#include "sine.h"
+
+float sine_table[SINE_TABLE_LENGTH + 1];
+
+void init_sine() {
+  for (int i = 0; i <= SINE_TABLE_LENGTH; i++) {
+    sine_table[i] = sin(2 * M_PI * i / SINE_TABLE_LENGTH);
+  }
+}
@@ -0,0 +1,93 @@
+// Fast replacements for sin(), which was our biggest single cost on the Pi.
+//
+// Everything here takes its argument in cycles, offset by half a cycle the
+// way the synth has always used it: sine_decimal(v) is sin((v+0.5)*2*pi).
+//
+// Pick an implementation at build time with -DSINE=SINE_...:
+//
+//   SINE_LIBM   libm sin(), in double.  Slow, but the reference.
+//   SINE_TABLE  SINE_TABLE_LENGTH-entry table with linear interpolation.
+//               Error is at most (2*pi/SINE_TABLE_LENGTH)^2/8, about 5e-6.
+//   SINE_POLY   Odd polynomial on a quarter cycle.  Error is about 1e-7,
+//               which is float rounding.
+//
+// zeros-bench measures and prints the error of whichever is built in.  The
+// vector version, sine_decimal4(), is for the oscillator bank; it's only
+// valid for |v| < 2^31, which the synth never gets near.
+
+#ifndef SINE_H
+#define SINE_H
+
+#include <math.h>
+#include "oscbank.h"
+
+#define SINE_LIBM 0
+#define SINE_TABLE 1
+#define SINE_POLY 2
+
+#ifndef SINE
+#define SINE SINE_POLY
+#endif
+
+#define SINE_TABLE_LENGTH (1024)  // must be a power of two
+
+// One cycle of sine, plus a copy of the first entry so interpolation never
+// has to wrap.  Filled by init_sine().
+extern float sine_table[SINE_TABLE_LENGTH + 1];
+
+void init_sine();
+
+// sin(2*pi*r) for r in [-0.25, 0.25]: the Taylor series to r^11, which is
+// within float rounding of sin() over that range.
+#define SINE_QUARTER(r, r2) \
+  ((r) * (6.2831853f + (r2) * (-41.341702f + (r2) * (81.605249f + \
+   (r2) * (-76.705860f + (r2) * (42.058694f + (r2) * -15.094643f))))))
+
+static inline float sine_decimal(float v) {
+#if SINE == SINE_LIBM
+  return sin((v+0.5)*M_PI*2);
+#elif SINE == SINE_TABLE
+  float u = v + 0.5f;
+  float x = (u - floorf(u)) * SINE_TABLE_LENGTH;
+  int i = (int)x;
+  float frac = x - i;
+  i &= SINE_TABLE_LENGTH - 1;  // u - floorf(u) can round up to 1
+  return sine_table[i] + frac * (sine_table[i + 1] - sine_table[i]);
+#else
+  // sin((v+0.5)*2*pi) is -sin(v*2*pi).  Reduce to [-0.5, 0.5] cycles, then
+  // fold onto [-0.25, 0.25] using sin(pi - x) = sin(x).
+  float r = v - floorf(v + 0.5f);
+  if (r > 0.25f) {
+    r = 0.5f - r;
+  } else if (r < -0.25f) {
+    r = -0.5f - r;
+  }
+  return -SINE_QUARTER(r, r*r);
+#endif
+}
+
+static inline v4sf sine_decimal4(v4sf v) {
+#if SINE == SINE_POLY
+  const v4sf one = {1, 1, 1, 1};
+  const v4sf half = one * 0.5f;
+  v4sf r = v - __builtin_convertvector(__builtin_convertvector(v, v4si), v4sf);
+  r -= (v4sf)((v4si)one & (r > half));
+  r += (v4sf)((v4si)one & (r < -half));
+  v4sf folded_up = half - r;
+  v4sf folded_down = -half - r;
+  v4si up = r > half * 0.5f;
+  v4si down = r < -half * 0.5f;
+  r = (v4sf)(((v4si)folded_up & up) | ((v4si)folded_down & down) |
+             ((v4si)r & ~(up | down)));
+  v4sf r2 = r * r;
+  return -SINE_QUARTER(r, r2);
+#else
+  v4sf out;
+  for (int l = 0; l < OSC_LANES; l++) {
+    out[l] = sine_decimal(v[l]);
+  }
+  return out;
+#endif
+}
+
+#endif
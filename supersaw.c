@@ -0,0 +1,131 @@
+#include <math.h>
+#include <stdlib.h>
+#include "supersaw.h"
+#include "synth.h"
+
+// By distance from the middle saw, which is loudest.  Up to 7 saws, these
+// are what the browser version always used.
+static const float saw_weights[(SUPERSAW_MAX_SAWS + 1) / 2] = {
+  1.0, 0.7, 0.5, 0.3, 0.25, 0.2, 0.15, 0.1};
+
+static inline v4sf select4(v4si mask, v4sf a, v4sf b) {
+  return (v4sf)(((v4si)a & mask) | ((v4si)b & ~mask));
+}
+
+static float ms_to_coefficient(float ms) {
+  float samples = ms / 1000 * synth_sample_rate();
+  return samples > 0 ? 1 - expf(-1 / samples) : 1;
+}
+
+void supersaw_reset(struct Supersaw* s) {
+  for (int j = 0; j < SUPERSAW_VECS; j++) {
+    s->phase[j] = s->phase[j] - s->phase[j];
+  }
+  s->detected_period = 0;
+  s->smoothed_period = 0;
+  s->smoothed_amp = 0;
+  s->onset_ramp = 0;
+  s->gated = 1;
+}
+
+void supersaw_configure(struct Supersaw* s, const struct SupersawDesign* d) {
+  int half = (d->saws - 1) / 2;
+  float weight_sum = 0;
+  for (int i = 0; i < d->saws; i++) {
+    weight_sum += saw_weights[abs(i - half)];
+  }
+
+  float ratio[SUPERSAW_VECS * OSC_LANES];
+  float inv_ratio[SUPERSAW_VECS * OSC_LANES];
+  float weight[SUPERSAW_VECS * OSC_LANES];
+  for (int i = 0; i < SUPERSAW_VECS * OSC_LANES; i++) {
+    float octaves =
+      half > 0 ? (i - half) * d->detune_cents / (half * 1200) : 0;
+    int used = i < d->saws;
+    ratio[i] = used ? exp2f(octaves) : 1;
+    inv_ratio[i] = used ? exp2f(-octaves) : 1;
+    weight[i] = used ? saw_weights[abs(i - half)] / weight_sum : 0;
+  }
+  s->vecs = (d->saws + OSC_LANES - 1) / OSC_LANES;
+  for (int j = 0; j < SUPERSAW_VECS; j++) {
+    for (int lane = 0; lane < OSC_LANES; lane++) {
+      s->ratio[j][lane] = ratio[j*OSC_LANES + lane];
+      s->inv_ratio[j][lane] = inv_ratio[j*OSC_LANES + lane];
+      s->weight[j][lane] = weight[j*OSC_LANES + lane];
+    }
+  }
+
+  s->octave_divisor = exp2f(d->octave_shift);
+  s->attack = ms_to_coefficient(d->attack_ms);
+  s->release = ms_to_coefficient(d->release_ms);
+  s->pitch_smooth =
+    1 - powf(1 - d->pitch_smooth, DEFAULT_SAMPLE_RATE / synth_sample_rate());
+  s->onset_samples = SUPERSAW_ONSET_SECONDS * synth_sample_rate();
+}
+
+// The envelope and pitch smoothing are scalar, and cheap; the saws are where
+// the time goes.  Each saw's phase increment is its ratio over the centre
+// period, and polyBLEP wants its inverse too, so with the ratios' inverses
+// precomputed there's one division per sample, for all the saws.  PolyBLEP
+// is evaluated both ways and selected per lane, without branches.
+void supersaw_run(struct Supersaw* s, const float* period, const char* gated,
+                  const float* rms, float* out, int n) {
+  const v4sf one = {1, 1, 1, 1};
+  const v4sf zero = one - one;
+  for (int i = 0; i < n; i++) {
+    if (period[i] > 0) {
+      s->detected_period = period[i];
+      if (s->smoothed_period == 0) {
+        s->smoothed_period = period[i];
+      }
+    }
+    if (s->smoothed_period > 0) {
+      s->smoothed_period +=
+        s->pitch_smooth * (s->detected_period - s->smoothed_period);
+    }
+
+    char was_gated = s->gated;
+    s->gated = gated[i];
+    float target_amp = gated[i] ? 0 : rms[i];
+    if (was_gated && !gated[i]) {
+      s->smoothed_amp = rms[i];
+      s->onset_ramp = 0;
+    } else if (target_amp > s->smoothed_amp) {
+      s->smoothed_amp += s->attack * (target_amp - s->smoothed_amp);
+    } else {
+      s->smoothed_amp += s->release * (target_amp - s->smoothed_amp);
+    }
+
+    float onset_scale = 1;
+    if (s->onset_ramp < s->onset_samples) {
+      onset_scale = (float)s->onset_ramp / s->onset_samples;
+      s->onset_ramp++;
+    }
+
+    if (s->smoothed_period <= 0) {
+      out[i] = 0;
+      continue;
+    }
+
+    float center_period = s->smoothed_period * s->octave_divisor;
+    float center_dt = 1 / center_period;
+    v4sf sum = zero;
+    for (int j = 0; j < s->vecs; j++) {
+      v4sf dt = s->ratio[j] * center_dt;
+      v4sf inv_dt = s->inv_ratio[j] * center_period;
+      v4sf phase = s->phase[j] + dt;
+      // Phases are never negative, so truncating is floor.
+      phase -= __builtin_convertvector(__builtin_convertvector(phase, v4si),
+                                       v4sf);
+      s->phase[j] = phase;
+
+      v4sf t = phase * inv_dt;  // just after the step
+      v4sf u = (phase - one) * inv_dt;  // just before it
+      v4sf blep = select4(phase < dt, t + t - t*t - one,
+                          select4(phase > one - dt, u*u + u + u + one, zero));
+      sum += (phase + phase - one - blep) * s->weight[j];
+    }
+    out[i] = (sum[0] + sum[1] + sum[2] + sum[3]) * s->smoothed_amp *
+      onset_scale;
+  }
+}
@@ -0,0 +1,56 @@
+// A supersaw: several detuned saws at the input's pitch, an octave or more
+// down.  Rather than play back the input, like the octaver's oscillators, it
+// follows the periods the octaver accepts, with its own smoothing, and the
+// input's loudness, with its own attack and release.
+//
+// Each saw is band-limited with polyBLEP, and the saws' phases advance
+// OSC_LANES at a time.  Everything that only depends on the design, like
+// each saw's detune ratio and weight, is worked out in supersaw_configure(),
+// so changing it costs nothing per sample.
+
+#ifndef SUPERSAW_H
+#define SUPERSAW_H
+
+#include "oscbank.h"
+#include "voices.h"
+
+#define SUPERSAW_VECS ((SUPERSAW_MAX_SAWS + OSC_LANES - 1) / OSC_LANES)
+
+// How long the output ramps up for when the gate opens, against clicks.
+#define SUPERSAW_ONSET_SECONDS (0.003)
+
+struct Supersaw {
+  // From the design.  Only the first vecs are run, and their unused lanes
+  // have weight 0.
+  int vecs;
+  v4sf ratio[SUPERSAW_VECS];  // each saw's frequency over the centre's
+  v4sf inv_ratio[SUPERSAW_VECS];
+  v4sf weight[SUPERSAW_VECS];  // normalized to sum to 1
+  float octave_divisor;
+  float attack;  // per-sample coefficients
+  float release;
+  float pitch_smooth;
+  int onset_samples;
+
+  v4sf phase[SUPERSAW_VECS];
+  float detected_period;
+  float smoothed_period;  // 0 until the first accepted period
+  float smoothed_amp;
+  int onset_ramp;
+  char gated;
+};
+
+// Silence, until the next accepted period.  Keeps the design.
+void supersaw_reset(struct Supersaw* s);
+
+// Take up a new design, without disturbing what's playing.  Times are
+// converted to samples at synth_sample_rate().
+void supersaw_configure(struct Supersaw* s, const struct SupersawDesign* d);
+
+// For each of n samples: period[i] is a period the octaver accepted at that
+// sample, or 0 if none; gated[i] whether the gate is closed; and rms[i] the
+// input's recent loudness.
+void supersaw_run(struct Supersaw* s, const float* period, const char* gated,
+                  const float* rms, float* out, int n);
+
+#endif
@@ -0,0 +1,1172 @@
+#define _GNU_SOURCE  // M_PI, CPU_SET
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "oscbank.h"
+#include "oversample.h"
+#include "pitch.h"
+#include "ring.h"
+#include "shaper.h"
+#include "sine.h"
+#include "supersaw.h"
+#include "synth.h"
+#include "voices.h"
+#ifdef SYNTH_HOSTED
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define SLIDE (4)
+// We amplify in two stages: first gain, then saturate, then volume.  This lets
+// us get the effect of saturation/clipping independent of the output volume.
+#define GAIN (1.0)
+#define VOLUME (1.0)
+
+#define GATE_SQUARED (0.01*0.01)
+#ifdef ARDUINO
+// The Teensy sketch always multiplied by GATE_SQUARED twice here, so its
+// recent window opens the gate at 1/10000 the energy; it keeps that.
+#define RECENT_GATE_SQUARED (40*40*GATE_SQUARED*GATE_SQUARED)
+#else
+#define RECENT_GATE_SQUARED (40*40*GATE_SQUARED)
+#endif
+//#define GRACE_TICKS (44100)
+
+// The gate listens to the input's energy over two windows: a long one, and
+// a recent one that also gives events their amplitude.
+#define GATE_SECONDS (8192.0/44100)  // 8192 samples at 44.1kHz, about 186ms
+#define RECENT_SECONDS (0.0058)
+
+#define BOOL char
+#define TRUE 1
+#define FALSE 0
+
+// With PITCH_MPM, crossings closer together than this many periods are
+// breath or harmonics, not the next cycle.
+#define MIN_CYCLE_FRACTION (0.75)
+
+#define DURATION_UNIT_SECONDS (0.00907)
+#define DURATION_BLOCKS (100) // of DURATION_UNIT_SECONDS each
+#define DURATION_MAX_VAL (0.04)
+
+float sample_rate = DEFAULT_SAMPLE_RATE;
+
+// Seconds to whole samples, at sample_rate.
+int seconds_to_samples(float seconds) {
+  return (int)(seconds * sample_rate + 0.5f);
+}
+
+/*******************************************************************/
+
+// val is the average, over the last DURATION_BLOCKS blocks, of the minimum
+// of that block and every block since.  Rather than rescan, we keep those
+// minima as runs: the window, oldest first, splits into runs that share a
+// minimum, and the minima strictly increase towards the newest.  A new block
+// swallows the runs at the end whose minimum is no smaller than it, and the
+// oldest block drops out of the first run, so each block costs O(1)
+// amortized.
+struct DurationRun {
+  float min;
+  int count;  // blocks
+};
+
+struct Duration {
+  struct DurationRun runs[DURATION_BLOCKS];
+  int first_run;
+  int n_runs;
+  double sum;  // of min*count over the runs
+
+  float current_total;
+  int current_count;
+  int units;  // samples per block
+  float val;
+};
+
+void init_duration(struct Duration* d) {
+  d->units = seconds_to_samples(DURATION_UNIT_SECONDS);
+  d->runs[0].min = 0;
+  d->runs[0].count = DURATION_BLOCKS;
+  d->first_run = 0;
+  d->n_runs = 1;
+  d->sum = 0;
+  d->current_total = 0;
+  d->current_count = 0;
+  d->val = 0;
+}
+
+void update_duration(struct Duration* d, float sample) {
+  d->current_total += fabs(sample);
+  d->current_count++;
+  if (d->current_count > d->units) {
+    float val = d->current_total / d->current_count;
+    d->current_total = 0;
+    d->current_count = 0;
+
+    struct DurationRun* oldest = &d->runs[d->first_run];
+    d->sum -= oldest->min;
+    if (--oldest->count == 0) {
+      d->first_run = (d->first_run + 1) % DURATION_BLOCKS;
+      d->n_runs--;
+    }
+
+    int count = 1;
+    while (d->n_runs > 0) {
+      struct DurationRun* last = &d->runs[
+        (d->first_run + d->n_runs - 1) % DURATION_BLOCKS];
+      if (last->min < val) {
+        break;
+      }
+      d->sum -= (double)last->min * last->count;
+      count += last->count;
+      d->n_runs--;
+    }
+    struct DurationRun* run = &d->runs[
+      (d->first_run + d->n_runs) % DURATION_BLOCKS];
+    run->min = val;
+    run->count = count;
+    d->n_runs++;
+    d->sum += (double)val * count;
+
+    d->val = fminf(d->sum/DURATION_BLOCKS, DURATION_MAX_VAL);
+  }
+}
+
+
+// The octaver's history is read by the oscillators, HISTORY_LENGTH back, and
+// by the gate, GATE_SECONDS back, each a block beyond that.  Above 48kHz the
+// gate needs more of it than the oscillators do.
+#if MAX_SAMPLE_RATE > 48000
+#define OCTAVER_HIST_LENGTH (2*HIST_BUFFER_LENGTH)
+#else
+#define OCTAVER_HIST_LENGTH (HIST_BUFFER_LENGTH)
+#endif
+
+struct Octaver {
+  float hist_buf[RING_STORAGE(OCTAVER_HIST_LENGTH)];
+  struct Ring hist;
+  long long cycles;
+  float samples_since_last_crossing;
+  float samples_since_attack_began;
+  BOOL positive;
+  float previous_sample;
+  float rough_input_period;
+  int64_t hist_sq;  // in ENERGY_ONEs
+  int64_t recent_hist_sq;
+  BOOL gate_open;  // as last published
+};
+
+// A worker thread that runs one whistler's blocks, handed over by the audio
+// thread.  started, claimed, and finished count blocks: the audio thread
+// bumps started, then whichever of the worker and the audio thread moves
+// claimed up to it runs the block, and finished says it's done.  The audio
+// thread never waits on the mutex, which is only there so the worker can
+// sleep.  Without SYNTH_HOSTED, never running.
+struct Worker {
+#ifdef SYNTH_HOSTED
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  unsigned int started;
+  unsigned int claimed;
+  unsigned int finished;
+#endif
+  BOOL running;
+};
+
+// Single-producer single-consumer ring of events, from the audio thread out
+// to zeros.c; the mirror image of the command queue below.  If nobody drains
+// it, new events are dropped.
+#define EVENT_QUEUE_LENGTH (256)  // must be a power of two
+
+// Everything one whistler's input needs on its way to the output, so that
+// several can run at once, each on its own core, without touching each
+// other's state.  Aligned so no two share a cache line.
+struct Whistler {
+  struct Octaver octaver;
+  struct PitchDetector pitch_detector;
+  struct Duration duration;
+  struct OscBank oscs;
+  struct Supersaw supersaw;  // instead of oscs, for supersaw voices
+  struct Oversampler oversampler;
+  float output;  // smoothed
+
+  // The voice's range, as periods in samples, and its smoothing's
+  // coefficient and makeup gain, at sample_rate.
+  float shortest_period;
+  float longest_period;
+  float alpha;
+  float makeup;
+
+  int voice;
+  int volume;
+  int gate;
+  float gain;
+  float ungain;
+  float gate_squared;
+  int64_t hist_gate;  // gate thresholds for octaver.hist_sq and recent_hist_sq
+  int64_t recent_gate;
+
+  struct Event event_queue[EVENT_QUEUE_LENGTH];
+  unsigned int event_write_pos;
+  unsigned int event_read_pos;
+
+  // The current block, deinterleaved, in and out.
+  float in[FRAMES_PER_BUFFER];
+  float out[FRAMES_PER_BUFFER];
+  int n;
+
+  struct Worker worker;
+} __attribute__((aligned(64)));
+
+struct Whistler whistlers[MAX_WHISTLERS];
+int n_whistlers = 1;
+
+void init_octaver(struct Whistler* w) {
+  struct Octaver* octaver = &w->octaver;
+  ring_init(&octaver->hist, octaver->hist_buf, OCTAVER_HIST_LENGTH);
+  pitch_reset(&w->pitch_detector);
+  octaver->cycles = 0;
+
+  octaver->samples_since_last_crossing = 0;
+  octaver->samples_since_attack_began = 0;
+
+  octaver->positive = TRUE;
+  octaver->previous_sample = 0;
+  octaver->rough_input_period = 40;
+  octaver->hist_sq = 0;
+  octaver->recent_hist_sq = 0;
+  octaver->gate_open = FALSE;
+}
+
+// The gate tracks the energy in the last gate_length and recent_length
+// samples by adding each sample's square as it arrives and subtracting it
+// again as it leaves.  We do that in fixed point, where it's exact, so
+// unlike a float sum the total never drifts and never needs recomputing.
+#define ENERGY_ONE (1LL << 40)
+#define ENERGY_MAX (16)  // per sample, so a window can't overflow
+
+// The gate's windows, in samples, at sample_rate.
+int gate_length = HISTORY_LENGTH;
+int recent_length = 256;
+
+static inline int64_t energy(float s) {
+  return (int64_t)(fminf(s*s, ENERGY_MAX) * ENERGY_ONE);
+}
+
+static inline float recent_rms(const struct Octaver* octaver) {
+  return sqrtf((float)octaver->recent_hist_sq /
+               ((float)ENERGY_ONE * recent_length));
+}
+
+// Live adjustments to each voice's design, as multipliers: 1 is as written
+// in voices[].
+float tweaks[N_VOICES][N_TWEAKS];
+
+// The oscillators for each voice, ready to copy in on each accepted crossing,
+// with tweaks applied.  Shared by all the whistlers, but only written between
+// blocks.
+struct Osc voice_oscs[N_VOICES][N_OSCS_PER_LAYER];
+
+// Each supersaw voice's design, with live changes applied.  Since these are
+// settings rather than multipliers, they replace voices[]'s.
+struct SupersawDesign supersaw_designs[N_VOICES];
+
+void build_voice_oscs(int v) {
+  for (int i = 0; i < voices[v].n_oscs; i++) {
+    const struct OscDesign* design = &voices[v].oscs[i];
+    struct Osc* osc = &voice_oscs[v][i];
+
+    osc->pos = 0;
+    osc->duration = voices[v].duration ? voices[v].duration : DURATION;
+
+    osc->lfo_step = design->lfo_rate / sample_rate;
+    osc->lfo_amplitude = design->lfo_amplitude;
+    osc->lfo_is_volume = design->lfo_is_volume;
+
+    osc->mode = design->mode;
+    osc->speed = design->speed * tweaks[v][TWEAK_SPEED];
+    osc->cycle = design->cycle * tweaks[v][TWEAK_CYCLE];
+    osc->mod = design->mod;
+    osc->polarity = 1;
+    osc->vol = design->vol * tweaks[v][TWEAK_VOL];
+
+    osc->rough_input_period = 0;
+  }
+}
+
+float volumes[10] = {
+                     0.026, // 0
+                     0.039, // 1
+                     0.059, // 2
+                     0.088, // 3
+                     0.132, // 4
+                     0.198, // 5
+                     0.296, // 6
+                     0.444, // 7
+                     0.667, // 8
+                     1.000, // 9
+};
+
+struct Oversampler delay_oversampler;
+
+void init_oscs(struct Whistler* w, float adjustment) {
+  const struct Voice* v = &voices[w->voice];
+  long long cycles = w->octaver.cycles;
+  if (v->every > 1) {
+    if (cycles % v->every) {
+      return;
+    }
+    cycles /= v->every;
+  }
+  int duration = v->duration ? v->duration : DURATION;
+  long long offset = (cycles % duration) * N_OSCS_PER_LAYER;
+
+  for (int i = 0; i < v->n_oscs; i++) {
+    struct Osc osc = voice_oscs[w->voice][i];
+    osc.pos = -adjustment;
+    if (osc.mod != 0) {
+      osc.polarity = ((int)(osc.cycle * cycles)) % osc.mod ? 1 : -1;
+    }
+    osc.rough_input_period = w->octaver.rough_input_period;
+    osc_bank_start(&w->oscs, offset+i, &osc);
+  }
+}
+
+uint64_t grace_ticks = 0;
+
+void publish_event(struct Whistler* w, int type, unsigned int time,
+                   float period) {
+  unsigned int write_pos = __atomic_load_n(&w->event_write_pos,
+                                           __ATOMIC_RELAXED);
+  unsigned int read_pos = __atomic_load_n(&w->event_read_pos,
+                                          __ATOMIC_ACQUIRE);
+  if (write_pos - read_pos >= EVENT_QUEUE_LENGTH) {
+    return;
+  }
+  struct Event* event = &w->event_queue[write_pos & (EVENT_QUEUE_LENGTH - 1)];
+  event->type = type;
+  event->time = time;
+  event->period = period;
+  event->amplitude = recent_rms(&w->octaver);
+  __atomic_store_n(&w->event_write_pos, write_pos + 1, __ATOMIC_RELEASE);
+}
+
+int next_event(int whistler, struct Event* event) {
+  struct Whistler* w = &whistlers[whistler];
+  unsigned int read_pos = __atomic_load_n(&w->event_read_pos,
+                                          __ATOMIC_RELAXED);
+  unsigned int write_pos = __atomic_load_n(&w->event_write_pos,
+                                           __ATOMIC_ACQUIRE);
+  if (read_pos == write_pos) {
+    return 0;
+  }
+  *event = w->event_queue[read_pos & (EVENT_QUEUE_LENGTH - 1)];
+  __atomic_store_n(&w->event_read_pos, read_pos + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+// Whether the octaver thought the input was positive just before in[i]: the
+// sign of the last non-zero sample.
+BOOL positive_before(const struct Octaver* octaver, const float* in, int i) {
+  for (int k = i - 1; k >= 0; k--) {
+    if (in[k] > 0) {
+      return TRUE;
+    } else if (in[k] < 0) {
+      return FALSE;
+    }
+  }
+  return octaver->positive;
+}
+
+// Runs at most FRAMES_PER_BUFFER samples, in passes over the whole chunk.
+// The input goes into the history first; then we handle each crossing as we
+// reach it, running the oscillators over everything since the previous
+// crossing, in one go, just before the crossing changes them.  A supersaw
+// voice has no oscillators, and instead runs over the whole chunk at the
+// end, with the periods accepted along the way.
+void update_chunk(struct Whistler* w, const struct Voice* v,
+                  const float* in, float* out, int n) {
+  struct Octaver* octaver = &w->octaver;
+  struct PitchDetector* pitch_detector = &w->pitch_detector;
+  BOOL gated[FRAMES_PER_BUFFER];
+  BOOL candidate[FRAMES_PER_BUFFER];
+  BOOL saw = v->supersaw.saws > 0;
+  float accepted[FRAMES_PER_BUFFER];
+  float rms[FRAMES_PER_BUFFER];
+  unsigned int chunk_start = octaver->hist.written;
+  ring_write_block(&octaver->hist, in, n);
+  BOOL use_mpm = v->pitch == PITCH_MPM;
+  if (use_mpm) {
+    pitch_update(pitch_detector, &octaver->hist, w->longest_period);
+  }
+
+  // The samples leaving each window as each of ours arrives.
+  const float* old = ring_span(&octaver->hist, chunk_start - gate_length);
+  const float* recent_old = ring_span(&octaver->hist,
+                                      chunk_start - recent_length);
+
+  for (int i = 0; i < n; i++) {
+    out[i] = 0;
+    int64_t e = energy(in[i]);
+    octaver->hist_sq += e - energy(old[i]);
+    octaver->recent_hist_sq += e - energy(recent_old[i]);
+    gated[i] = (octaver->hist_sq < w->hist_gate &&
+                octaver->recent_hist_sq < w->recent_gate);
+    if (saw) {
+      rms[i] = recent_rms(octaver);
+      accepted[i] = 0;
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    update_duration(&w->duration, in[i]);
+  }
+
+  // A crossing is a negative sample when we were positive.  Almost always
+  // that means the sample before was positive, so find those in a branch-free
+  // pass the compiler can vectorize, and only look further back when the
+  // sample before was exactly zero.
+  candidate[0] = (in[0] < 0) & (octaver->previous_sample >= 0);
+  for (int i = 1; i < n; i++) {
+    candidate[i] = (in[i] < 0) & (in[i-1] >= 0);
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (gated[i] == octaver->gate_open) {
+      octaver->gate_open = !gated[i];
+      publish_event(w, gated[i] ? EVENT_OFFSET : EVENT_ONSET,
+                    chunk_start + i, 0);
+    }
+  }
+
+  int run_from = 0;
+  int last_crossing = -1;
+  float heard_period = 0;
+  for (int i = 0; i < n; i++) {
+    if (!candidate[i] || !positive_before(octaver, in, i)) {
+      continue;
+    }
+
+    /*
+     * Let's say we take samples at p and n:
+     *
+     *  p
+     *   \
+     *    \
+     *  -------
+     *      \
+     *       n
+     *
+     * we could say the zero crossing is at n, but better would be to say
+     * it's between p and n in proportion to how far each is from zero.  So,
+     * if n is the current sample, that's:
+     *
+     *        |n|
+     *   - ---------
+     *     |n| + |p|
+     *
+     * But p is always positive and n is always negative, so really:
+     *
+     *        |n|            -n         n
+     *   - ---------  =  - ------  =  -----
+     *     |n| + |p|       -n + p     p - n
+     */
+    float first_negative = in[i];
+    float last_positive = i > 0 ? in[i-1] : octaver->previous_sample;
+    float adjustment = first_negative / (last_positive - first_negative);
+    if (isnan(adjustment)) {
+      adjustment = 0;
+    }
+    float since_last_crossing =
+      octaver->samples_since_last_crossing + (i - last_crossing) - adjustment;
+    float period = since_last_crossing;
+    if (use_mpm) {
+      if (pitch_detector->period > 0 &&
+          since_last_crossing < MIN_CYCLE_FRACTION * pitch_detector->period) {
+        continue;
+      }
+      period = pitch_detector->period;
+    }
+    octaver->samples_since_last_crossing = since_last_crossing;
+    octaver->rough_input_period = period;
+
+    osc_bank_run(&w->oscs, &octaver->hist, chunk_start + run_from + 1,
+                 i - run_from, out + run_from);
+    run_from = i;
+
+    if (octaver->rough_input_period > w->shortest_period &&
+        octaver->rough_input_period < w->longest_period) {
+      if (saw) {
+        accepted[i] = octaver->rough_input_period;
+      } else {
+        init_oscs(w, adjustment);
+      }
+      heard_period = octaver->rough_input_period;
+    }
+
+    octaver->cycles++;
+    osc_bank_cycle(&w->oscs);
+
+    octaver->samples_since_last_crossing = -adjustment;
+    last_crossing = i;
+  }
+
+  osc_bank_run(&w->oscs, &octaver->hist, chunk_start + run_from + 1,
+               n - run_from, out + run_from);
+
+  octaver->samples_since_last_crossing += n - 1 - last_crossing;
+  octaver->samples_since_attack_began += n;
+  octaver->positive = positive_before(octaver, in, n);
+  octaver->previous_sample = in[n-1];
+
+  // At most one pitch per block is plenty for anything listening.
+  if (heard_period > 0 && octaver->gate_open) {
+    publish_event(w, EVENT_PITCH, chunk_start + n - 1, heard_period);
+  }
+
+  // The supersaw has its own envelope, which releases when the gate closes.
+  if (saw) {
+    supersaw_run(&w->supersaw, accepted, gated, rms, out, n);
+    for (int i = 0; i < n; i++) {
+      out[i] *= GAIN * w->gain;
+    }
+    return;
+  }
+
+  for (int i = 0; i < n; i++) {
+    out[i] = gated[i] ? 0 : out[i] * GAIN * w->gain;
+  }
+}
+
+void whistler_update_block(struct Whistler* w, const float* in, float* out,
+                           int n) {
+  const struct Voice* v = &voices[w->voice];
+  if (v->raw) {
+    for (int i = 0; i < n; i++) {
+      out[i] = in[i] * w->gain;
+    }
+    return;
+  }
+
+  for (int i = 0; i < n; i += FRAMES_PER_BUFFER) {
+    int chunk = n - i;
+    if (chunk > FRAMES_PER_BUFFER) {
+      chunk = FRAMES_PER_BUFFER;
+    }
+    update_chunk(w, v, in + i, out + i, chunk);
+  }
+}
+
+void update_block(int whistler, const float* in, float* out, int n) {
+  whistler_update_block(&whistlers[whistler], in, out, n);
+}
+
+// The whole chain for one whistler's current block, from w->in to w->out.
+// Anything that depends on the voice is read once per block; commands only
+// change it between blocks anyway.
+void process_whistler(struct Whistler* w) {
+  const struct Voice* v = &voices[w->voice];
+  float alpha = w->alpha;
+  float makeup = w->makeup;
+  float out_scale = VOLUME * volumes[w->volume] * w->ungain;
+  float* vals = w->out;
+  int n = w->n;
+
+  whistler_update_block(w, w->in, vals, n);
+
+  for (int i = 0; i < n; i++) {
+    w->output += alpha * (vals[i] - w->output);
+    vals[i] = w->output * makeup;
+  }
+
+  // never wrap -- wrapping sounds horrible
+  oversample_shape(&w->oversampler, v->oversample, v->distort, vals, n);
+
+  for (int i = 0; i < n; i++) {
+    // Ideally this clip is never hit, but it would be really bad if it
+    // wrapped.
+    vals[i] = clip(vals[i] * out_scale);
+  }
+}
+
+#ifdef SYNTH_HOSTED
+void* run_worker(void* arg) {
+  struct Whistler* w = arg;
+  struct Worker* worker = &w->worker;
+#ifdef __linux__
+  // Spread the whistlers over the cores; the audio thread keeps the first
+  // whistler wherever the scheduler puts it.
+  long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n_cpus > 1) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET((w - whistlers) % n_cpus, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+#endif
+
+  unsigned int seen = 0;
+  while (1) {
+    pthread_mutex_lock(&worker->mutex);
+    while (__atomic_load_n(&worker->started, __ATOMIC_ACQUIRE) == seen) {
+      pthread_cond_wait(&worker->cond, &worker->mutex);
+    }
+    pthread_mutex_unlock(&worker->mutex);
+    seen = __atomic_load_n(&worker->started, __ATOMIC_ACQUIRE);
+
+    // If the audio thread gave up on us and ran it itself, skip it.
+    unsigned int previous = seen - 1;
+    if (__atomic_compare_exchange_n(&worker->claimed, &previous, seen, FALSE,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      process_whistler(w);
+      __atomic_store_n(&worker->finished, seen, __ATOMIC_RELEASE);
+    }
+  }
+  return NULL;
+}
+
+int start_whistler_threads(int rt_priority) {
+  int started = 0;
+  for (int i = 1; i < n_whistlers; i++) {
+    struct Worker* worker = &whistlers[i].worker;
+    if (worker->running) {
+      started++;
+      continue;
+    }
+    pthread_mutex_init(&worker->mutex, NULL);
+    pthread_cond_init(&worker->cond, NULL);
+    worker->started = 0;
+    worker->claimed = 0;
+    worker->finished = 0;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (rt_priority) {
+      struct sched_param param;
+      param.sched_priority = rt_priority;
+      pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+      pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+      pthread_attr_setschedparam(&attr, &param);
+    }
+    int err = pthread_create(&worker->thread, &attr, &run_worker,
+                             &whistlers[i]);
+    pthread_attr_destroy(&attr);
+    if (err) {
+      // Probably not allowed real-time priority.  A worker below the audio
+      // thread's priority could be starved by it in finish_whistler(), so
+      // rather than start one at normal priority, leave this whistler to the
+      // audio thread.
+      fprintf(stderr, "could not start a thread for whistler %d (%s); "
+              "the audio thread will run it\n", i, strerror(err));
+      continue;
+    }
+    worker->running = TRUE;
+    started++;
+  }
+  return started;
+}
+#else
+int start_whistler_threads(int rt_priority) {
+  return 0;
+}
+#endif
+
+// Hand w's block to its worker, or if it doesn't have one, just do it.
+void start_whistler(struct Whistler* w) {
+  struct Worker* worker = &w->worker;
+  if (!worker->running) {
+    process_whistler(w);
+    return;
+  }
+#ifdef SYNTH_HOSTED
+  __atomic_store_n(&worker->started, worker->started + 1, __ATOMIC_RELEASE);
+  // The worker only holds the mutex between checking started and going to
+  // sleep.  If it has it now the wakeup may be lost, in which case
+  // finish_whistler() runs the block here.
+  if (pthread_mutex_trylock(&worker->mutex) == 0) {
+    pthread_cond_signal(&worker->cond);
+    pthread_mutex_unlock(&worker->mutex);
+  }
+#endif
+}
+
+// How many times finish_whistler() checks on a worker before deciding it
+// isn't coming and running the block itself; a few microseconds.
+#define WORKER_SPINS 2000
+
+void finish_whistler(struct Whistler* w) {
+  struct Worker* worker = &w->worker;
+  if (!worker->running) {
+    return;
+  }
+#ifdef SYNTH_HOSTED
+  unsigned int block = worker->started;
+  for (int i = 0; i < WORKER_SPINS; i++) {
+    if (__atomic_load_n(&worker->finished, __ATOMIC_ACQUIRE) == block) {
+      return;
+    }
+  }
+
+  // The worker hasn't picked the block up (descheduled, or it missed the
+  // wakeup), so do it here: slower than in parallel, but never a stall.
+  unsigned int previous = block - 1;
+  if (__atomic_compare_exchange_n(&worker->claimed, &previous, block, FALSE,
+                                  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    process_whistler(w);
+    __atomic_store_n(&worker->finished, block, __ATOMIC_RELEASE);
+    return;
+  }
+
+  // The worker is partway through it, so all we can do is wait.  It isn't
+  // holding anything we need, and it runs at the audio thread's priority
+  // (real-time or not; see start_whistler_threads()), so yielding lets it
+  // finish even on a shared core: we wait out the rest of one whistler's
+  // block, and no longer.
+  while (__atomic_load_n(&worker->finished, __ATOMIC_ACQUIRE) != block) {
+    sched_yield();
+  }
+#endif
+}
+
+float bpm_to_samples(float bpm) {
+  float bps = bpm/60;
+  return sample_rate / bps;
+}
+
+float delay_tempo_bpm = 118.5;
+int delay_repeats = 3;
+float delay_volume = 1;
+BOOL delay_enabled = TRUE;
+
+// Long enough for the furthest repeat at any tempo and repeat count we
+// accept, rounded up to a power of two for Ring.  delay_history is its
+// storage, NULL if the delay is disabled.
+float* delay_history = NULL;
+unsigned int delay_length = 0;
+struct Ring delay_line;
+
+// Where each repeat reads from, worked out once per change of settings.
+// Repeat r reads offset[r] samples back, weighted by 1-frac[r], and one
+// further, weighted by frac[r].
+struct DelayTaps {
+  int repeats;
+  unsigned int offset[DELAY_MAX_REPEATS];
+  float frac[DELAY_MAX_REPEATS];
+  float gain;  // volume, divided among the repeats
+};
+
+// When the settings change we fade from the old taps to the new ones over
+// DELAY_FADE_SECONDS, since jumping read heads would click.  Changes that
+// come in mid-fade wait for it to finish.
+#define DELAY_FADE_SECONDS (0.023)
+int delay_fade_samples = 1024;
+struct DelayTaps delay_taps;
+struct DelayTaps delay_old_taps;
+int delay_fade_left = 0;
+BOOL delay_taps_stale = FALSE;
+
+void set_delay_taps(struct DelayTaps* taps) {
+  float repeat_delta_samples = bpm_to_samples(delay_tempo_bpm);
+  taps->repeats = delay_repeats;
+  for (int repeat = 1; repeat <= delay_repeats; repeat++) {
+    float repeat_offset = repeat_delta_samples*repeat;
+    taps->offset[repeat-1] = (unsigned int)repeat_offset;
+    taps->frac[repeat-1] = repeat_offset - taps->offset[repeat-1];
+  }
+  taps->gain = delay_volume / delay_repeats;
+}
+
+// The delay's output as of the sample at write_pos.
+static inline float read_taps(const struct DelayTaps* taps,
+                              unsigned int write_pos) {
+  float sample_out = 0;
+  for (int r = 0; r < taps->repeats; r++) {
+    float frac = taps->frac[r];
+    const float* pair = ring_span(&delay_line, write_pos - taps->offset[r] - 1);
+    sample_out += (pair[0] * frac) + (pair[1] * (1-frac));
+  }
+  return sample_out * taps->gain;
+}
+
+void set_delay_enabled(int enabled) {
+  delay_enabled = enabled;
+}
+
+void set_sample_rate(float hz) {
+  sample_rate = hz;
+}
+
+float synth_sample_rate() {
+  return sample_rate;
+}
+
+void set_whistlers(int n) {
+  n_whistlers = n < 1 ? 1 : n > MAX_WHISTLERS ? MAX_WHISTLERS : n;
+}
+
+int synth_channels() {
+  int channels = n_whistlers + (delay_enabled ? 1 : 0);
+  return channels < 2 ? 2 : channels;
+}
+
+void init_delay() {
+  if (!delay_enabled) {
+    free(delay_history);
+    delay_history = NULL;
+    return;
+  }
+
+  set_delay_taps(&delay_taps);
+  delay_fade_samples = seconds_to_samples(DELAY_FADE_SECONDS);
+  delay_fade_left = 0;
+  delay_taps_stale = FALSE;
+
+  float longest = bpm_to_samples(DELAY_MIN_BPM) * DELAY_MAX_REPEATS;
+  unsigned int length = 1;
+  while (length < longest + 2) {
+    length *= 2;
+  }
+  if (!delay_history || length != delay_length) {
+    free(delay_history);
+    delay_length = length;
+    delay_history = malloc(RING_STORAGE(length) * sizeof(float));
+    if (!delay_history) {
+      fprintf(stderr, "could not allocate the delay line; delay disabled\n");
+      return;
+    }
+#ifdef SYNTH_HOSTED
+    // Best effort: keep it resident so the audio thread never faults it in.
+    // zeros.c's mlockall() covers it too, when allowed.
+    if (mlock(delay_history, RING_STORAGE(length) * sizeof(float)) != 0) {
+      perror("could not lock the delay line in memory");
+    }
+#endif
+  }
+  ring_init(&delay_line, delay_history, length);
+}
+
+void delay_block(const float* in, float* out, int n) {
+  if (!delay_history) {
+    memset(out, 0, n * sizeof(float));
+    return;
+  }
+
+  if (delay_taps_stale && !delay_fade_left) {
+    delay_old_taps = delay_taps;
+    set_delay_taps(&delay_taps);
+    delay_fade_left = delay_fade_samples;
+    delay_taps_stale = FALSE;
+  }
+
+  for (int i = 0; i < n; i++) {
+    unsigned int write_pos = delay_line.written;
+    ring_write(&delay_line, in[i]);
+
+    float sample_out = read_taps(&delay_taps, write_pos);
+    if (delay_fade_left) {
+      float old = read_taps(&delay_old_taps, write_pos);
+      float t = (float)delay_fade_left / delay_fade_samples;
+      sample_out += t * (old - sample_out);
+      delay_fade_left--;
+    }
+
+    out[i] = sample_out;
+  }
+}
+
+// A one-pole lowpass with cutoff hz, as a per-sample coefficient at rate.
+float one_pole_alpha(float hz, float rate) {
+  return hz > 0 ? 1 - expf(-2 * M_PI * hz / rate) : 1;
+}
+
+// The smoothing leaves about cutoff/f of what's above its cutoff, at any
+// rate, so the makeup gain the voices were tuned with at
+// DEFAULT_SAMPLE_RATE, 1/alpha, holds at every rate.
+void init_gains(struct Whistler* w) {
+  const struct Voice* v = &voices[w->voice];
+  w->gain = v->gain * tweaks[w->voice][TWEAK_GAIN];
+  w->ungain = v->ungain;
+  w->alpha = one_pole_alpha(v->smoothing, sample_rate);
+  w->makeup = 1 / one_pole_alpha(v->smoothing, DEFAULT_SAMPLE_RATE);
+}
+
+void init_range(struct Whistler* w) {
+  const struct Voice* v = &voices[w->voice];
+  w->shortest_period = sample_rate / v->range_high;
+  w->longest_period = sample_rate / v->range_low;
+}
+
+void init_gate(struct Whistler* w) {
+  w->gate_squared = ((volumes[9-w->gate] / volumes[5]) *
+                     (volumes[9-w->gate] / volumes[5]));
+  w->hist_gate = (int64_t)((double)GATE_SQUARED * w->gate_squared *
+                           gate_length * ENERGY_ONE);
+  w->recent_gate = (int64_t)((double)RECENT_GATE_SQUARED * w->gate_squared *
+                             recent_length * ENERGY_ONE);
+}
+
+void init_supersaw(struct Whistler* w) {
+  supersaw_reset(&w->supersaw);
+  supersaw_configure(&w->supersaw, &supersaw_designs[w->voice]);
+}
+
+void set_params(int whistler, int new_voice, int new_volume, int new_gate) {
+  struct Whistler* w = &whistlers[whistler];
+  w->voice = new_voice;
+  w->volume = new_volume;
+  w->gate = new_gate;
+  init_octaver(w);
+  init_supersaw(w);
+  init_gains(w);
+  init_range(w);
+  init_gate(w);
+}
+
+void tweak_supersaw(struct SupersawDesign* d, int type, float amount) {
+  if (type == CMD_SUPERSAW_SAWS) {
+    d->saws = amount;
+  } else if (type == CMD_SUPERSAW_DETUNE) {
+    d->detune_cents = amount;
+  } else if (type == CMD_SUPERSAW_OCTAVES) {
+    d->octave_shift = amount;
+  } else if (type == CMD_SUPERSAW_ATTACK) {
+    d->attack_ms = amount;
+  } else if (type == CMD_SUPERSAW_RELEASE) {
+    d->release_ms = amount;
+  } else if (type == CMD_SUPERSAW_SMOOTH) {
+    d->pitch_smooth = amount;
+  }
+}
+
+// Single-producer single-consumer ring of pending commands.  Each position
+// is only ever written by one side, and the release store of a position
+// publishes the slots before it.
+#define COMMAND_QUEUE_LENGTH (64)  // must be a power of two
+struct Command command_queue[COMMAND_QUEUE_LENGTH];
+unsigned int command_write_pos = 0;
+unsigned int command_read_pos = 0;
+
+// Whether apply_commands() can act on a command without indexing anything
+// out of bounds.  Amounts that only scale something aren't checked.
+BOOL command_in_range(int whistler, int type, int value, float amount) {
+  if (type == CMD_VOICE || type == CMD_VOLUME || type == CMD_GATE) {
+    if (whistler < 0 || whistler >= n_whistlers) {
+      return FALSE;
+    }
+    return value >= 0 && value <= (type == CMD_VOICE ? N_VOICES - 1 : 9);
+  } else if (type == CMD_DELAY_BPM) {
+    return amount >= DELAY_MIN_BPM && amount <= DELAY_MAX_BPM;
+  } else if (type == CMD_DELAY_REPEATS) {
+    return value >= 1 && value <= DELAY_MAX_REPEATS;
+  } else if (type == CMD_DELAY_VOLUME) {
+    return TRUE;
+  } else if ((type >= CMD_TWEAK_GAIN && type < CMD_TWEAK_GAIN + N_TWEAKS) ||
+             (type >= CMD_SUPERSAW_SAWS && type <= CMD_SUPERSAW_SMOOTH)) {
+    if (value < 0 || value >= N_VOICES) {
+      return FALSE;
+    }
+    return type != CMD_SUPERSAW_SAWS ||
+      (amount >= 1 && amount <= SUPERSAW_MAX_SAWS && (int)amount % 2 == 1);
+  }
+  return FALSE;
+}
+
+int send_command(int whistler, int type, int value, float amount) {
+  if (!command_in_range(whistler, type, value, amount)) {
+    return 0;
+  }
+  unsigned int write_pos = __atomic_load_n(&command_write_pos, __ATOMIC_RELAXED);
+  unsigned int read_pos = __atomic_load_n(&command_read_pos, __ATOMIC_ACQUIRE);
+  if (write_pos - read_pos >= COMMAND_QUEUE_LENGTH) {
+    return 0;
+  }
+  struct Command* command =
+    &command_queue[write_pos & (COMMAND_QUEUE_LENGTH - 1)];
+  command->whistler = whistler;
+  command->type = type;
+  command->value = value;
+  command->amount = amount;
+  __atomic_store_n(&command_write_pos, write_pos + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+// Runs on the audio thread while the workers are idle, so it's free to
+// change anything.
+void apply_commands() {
+  unsigned int read_pos = __atomic_load_n(&command_read_pos, __ATOMIC_RELAXED);
+  unsigned int write_pos = __atomic_load_n(&command_write_pos, __ATOMIC_ACQUIRE);
+  if (read_pos == write_pos) {
+    return;
+  }
+
+  // All of them, not just n_whistlers, so none is ever uninitialized.
+  int new_voice[MAX_WHISTLERS];
+  int new_volume[MAX_WHISTLERS];
+  int new_gate[MAX_WHISTLERS];
+  for (int i = 0; i < MAX_WHISTLERS; i++) {
+    new_voice[i] = whistlers[i].voice;
+    new_volume[i] = whistlers[i].volume;
+    new_gate[i] = whistlers[i].gate;
+  }
+  for (; read_pos != write_pos; read_pos++) {
+    struct Command* command =
+      &command_queue[read_pos & (COMMAND_QUEUE_LENGTH - 1)];
+    int w = command->whistler;
+    if (command->type == CMD_VOICE) {
+      if (voices[command->value].name[0]) {
+        new_voice[w] = command->value;
+      }
+    } else if (command->type == CMD_VOLUME) {
+      new_volume[w] = command->value;
+    } else if (command->type == CMD_GATE) {
+      new_gate[w] = command->value;
+    } else if (command->type == CMD_DELAY_BPM) {
+      delay_tempo_bpm = command->amount;
+      delay_taps_stale = TRUE;
+    } else if (command->type == CMD_DELAY_REPEATS) {
+      delay_repeats = command->value;
+      delay_taps_stale = TRUE;
+    } else if (command->type == CMD_DELAY_VOLUME) {
+      delay_volume = command->amount;
+      delay_taps_stale = TRUE;
+    } else if (command->type >= CMD_TWEAK_GAIN &&
+               command->type < CMD_TWEAK_GAIN + N_TWEAKS) {
+      tweaks[command->value][command->type - CMD_TWEAK_GAIN] =
+        command->amount;
+      build_voice_oscs(command->value);
+      for (int i = 0; i < n_whistlers; i++) {
+        if (command->value == whistlers[i].voice) {
+          init_gains(&whistlers[i]);
+        }
+      }
+    } else if (command->type >= CMD_SUPERSAW_SAWS &&
+               command->type <= CMD_SUPERSAW_SMOOTH) {
+      if (!voices[command->value].supersaw.saws) {
+        continue;
+      }
+      tweak_supersaw(&supersaw_designs[command->value], command->type,
+                     command->amount);
+      for (int i = 0; i < n_whistlers; i++) {
+        if (command->value == whistlers[i].voice) {
+          supersaw_configure(&whistlers[i].supersaw,
+                             &supersaw_designs[command->value]);
+        }
+      }
+    }
+  }
+  __atomic_store_n(&command_read_pos, read_pos, __ATOMIC_RELEASE);
+
+  for (int i = 0; i < n_whistlers; i++) {
+    struct Whistler* w = &whistlers[i];
+    if (new_voice[i] != w->voice || new_volume[i] != w->volume ||
+        new_gate[i] != w->gate) {
+      set_params(i, new_voice[i], new_volume[i], new_gate[i]);
+    }
+  }
+}
+
+float input_period(int whistler) {
+  return whistlers[whistler].octaver.rough_input_period;
+}
+
+void init_synth() {
+  gate_length = seconds_to_samples(GATE_SECONDS);
+  if (gate_length > OCTAVER_HIST_LENGTH - FRAMES_PER_BUFFER) {
+    // Only above MAX_SAMPLE_RATE.
+    gate_length = OCTAVER_HIST_LENGTH - FRAMES_PER_BUFFER;
+  }
+  recent_length = seconds_to_samples(RECENT_SECONDS);
+
+  init_sine();
+  init_pitch();
+  init_shapers();
+  init_oversampling();
+  init_oversampler(&delay_oversampler);
+
+  for (int v = 0; v < N_VOICES; v++) {
+    for (int t = 0; t < N_TWEAKS; t++) {
+      tweaks[v][t] = 1;
+    }
+    build_voice_oscs(v);
+    supersaw_designs[v] = voices[v].supersaw;
+  }
+
+  for (int i = 0; i < n_whistlers; i++) {
+    struct Whistler* w = &whistlers[i];
+    w->voice = V_EBASS;
+    w->volume = 5;
+    w->gate = 1;
+    init_oversampler(&w->oversampler);
+    init_octaver(w);
+    init_supersaw(w);
+    init_gains(w);
+    init_range(w);
+    init_gate(w);
+    osc_bank_init(&w->oscs, sample_rate);
+    init_duration(&w->duration);
+    w->output = 0;
+  }
+
+  init_delay();
+}
+
+// Each stage runs over the whole block before the next starts, so each is a
+// tight loop over contiguous buffers.  The whistlers after the first run on
+// their workers, if they have them, while this thread does the first and the
+// delay.
+void process_frames(const float* in, float* out, int frames) {
+  apply_commands();
+
+  const struct Voice* v = &voices[whistlers[0].voice];
+  int channels = synth_channels();
+  int delay_channel = delay_enabled ? n_whistlers : -1;
+
+  float delay_in[FRAMES_PER_BUFFER];
+  float delay_out[FRAMES_PER_BUFFER];
+
+  for (int start = 0; start < frames; start += FRAMES_PER_BUFFER) {
+    int n = frames - start;
+    if (n > FRAMES_PER_BUFFER) {
+      n = FRAMES_PER_BUFFER;
+    }
+    const float* block_in = in + start*channels;
+    float* block_out = out + start*channels;
+
+    for (int w = 0; w < n_whistlers; w++) {
+      for (int i = 0; i < n; i++) {
+        whistlers[w].in[i] = block_in[i*channels + w];
+      }
+      whistlers[w].n = n;
+    }
+
+    for (int w = 1; w < n_whistlers; w++) {
+      start_whistler(&whistlers[w]);
+    }
+    process_whistler(&whistlers[0]);
+    if (delay_channel >= 0) {
+      for (int i = 0; i < n; i++) {
+        delay_in[i] = block_in[i*channels + delay_channel];
+      }
+      delay_block(delay_in, delay_out, n);
+      oversample_shape(&delay_oversampler, v->oversample, v->distort,
+                       delay_out, n);
+    }
+    for (int w = 1; w < n_whistlers; w++) {
+      finish_whistler(&whistlers[w]);
+    }
+
+    // Any channel without a whistler or the delay is silent.
+    for (int c = 0; c < channels; c++) {
+      const float* from = c < n_whistlers ? whistlers[c].out :
+        c == delay_channel ? delay_out : NULL;
+      for (int i = 0; i < n; i++) {
+        block_out[i*channels + c] = from ? from[i] : 0;
+      }
+    }
+  }
+}
@@ -0,0 +1,178 @@
+// The whistle synth's signal chain, independent of how audio gets in and out.
+//
+// zeros.c drives this from PortAudio; render.c drives it from a WAV file.
+// Everything here runs on the audio thread except send_command(),
+// next_event(), and the whistler workers.
+
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include "voices.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The same engine builds three ways: hosted, for zeros-linux, zeros-mac,
+// zeros-render, and zeros-bench; for the Teensy, under Arduino, driven by
+// zeros.ino; and for WebAssembly, driven by wasm.c.  Only the hosted build
+// gets what needs an operating system: worker threads and locked memory.
+#if !defined(ARDUINO) && !defined(__wasm__)
+#define SYNTH_HOSTED 1
+#endif
+
+#define DEFAULT_SAMPLE_RATE (44100)
+
+// The highest rate whose windows are all their full length in seconds;
+// above it the gate's long window is cut short.  The Teensy only runs at
+// 44.1kHz, so it doesn't pay for the history a higher rate needs.
+#ifdef ARDUINO
+#define MAX_SAMPLE_RATE (48000)
+#else
+#define MAX_SAMPLE_RATE (96000)
+#endif
+#define FRAMES_PER_BUFFER   (128)    // this is low, to minimize latency
+
+#define V_SOPRANO_RECORDER 1
+#define V_BASS_FLUTE 2
+#define V_DIST 3
+#define V_REED 4
+#define V_FLUTE 5
+#define V_EBASS 6
+#define V_VOCAL_2 7
+#define V_VOCAL_1 8
+#define V_RAW 9
+#define V_RAWDIST 0
+#define V_DEEP_SINE 10
+#define V_SUPERSAW 11
+
+// Call once before processing any audio, after any load_voices().  Every
+// time constant, from the voices' ranges to the delay's tempo, is kept in
+// seconds or Hz and converted to samples here, at the rate last set.
+void init_synth();
+
+// The rate audio comes in and goes out at, in Hz; DEFAULT_SAMPLE_RATE
+// unless set.  Call before init_synth().
+void set_sample_rate(float hz);
+float synth_sample_rate();
+
+// Whistlers each have their own input channel, octaver, oscillators, and
+// voice, and share nothing while processing, so they can run on separate
+// cores.  Whistler w listens on channel w and plays on channel w.
+#ifndef MAX_WHISTLERS
+#ifdef SYNTH_HOSTED
+#define MAX_WHISTLERS (4)
+#else
+#define MAX_WHISTLERS (1)  // each takes over 100KB
+#endif
+#endif
+
+// How many whistlers to run, 1 to MAX_WHISTLERS; anything else is clamped
+// to that range.  Call before init_synth().
+void set_whistlers(int n);
+
+// Whether to run the delay, on the channel after the last whistler.
+// Without it no memory is set aside for the delay line.  Call before
+// init_synth().
+void set_delay_enabled(int enabled);
+
+// How many interleaved channels process_frames() takes and gives: one for
+// each whistler and the delay, but at least two, so a single whistler
+// without the delay is still stereo, with a silent channel 1.
+int synth_channels();
+
+// Run each whistler after the first on a worker thread of its own, pinned
+// to its own core where there are enough, at SCHED_FIFO rt_priority if
+// that's non-zero.  Pass the audio thread's priority.  If that isn't
+// allowed, and always when not SYNTH_HOSTED, the audio thread runs them all
+// in turn.  Call after
+// init_synth().  Returns how many workers are running.
+int start_whistler_threads(int rt_priority);
+
+// Select whistler's voice, volume (0-9), and gate (0-9).  Resets its
+// octaver, so only call this when something has actually changed.  Only safe
+// when audio isn't running; while it is, use send_command().
+void set_params(int whistler, int voice, int volume, int gate);
+
+#define TWEAK_GAIN 0
+#define TWEAK_SPEED 1
+#define TWEAK_CYCLE 2
+#define TWEAK_VOL 3
+#define N_TWEAKS 4
+
+#define CMD_VOICE 0
+#define CMD_VOLUME 1
+#define CMD_GATE 2
+// value is the voice, amount is the multiplier.
+#define CMD_TWEAK_GAIN (3 + TWEAK_GAIN)
+#define CMD_TWEAK_SPEED (3 + TWEAK_SPEED)
+#define CMD_TWEAK_CYCLE (3 + TWEAK_CYCLE)
+#define CMD_TWEAK_VOL (3 + TWEAK_VOL)
+// The delay.  These fade over a few ms rather than jump.
+#define CMD_DELAY_BPM (3 + N_TWEAKS)  // amount is the tempo
+#define CMD_DELAY_REPEATS (4 + N_TWEAKS)  // value is the number of repeats
+#define CMD_DELAY_VOLUME (5 + N_TWEAKS)  // amount is the multiplier
+// A supersaw voice's design, as in struct SupersawDesign.  value is the
+// voice, amount the new setting.  These don't reset what's playing.
+#define CMD_SUPERSAW_SAWS (6 + N_TWEAKS)
+#define CMD_SUPERSAW_DETUNE (7 + N_TWEAKS)
+#define CMD_SUPERSAW_OCTAVES (8 + N_TWEAKS)
+#define CMD_SUPERSAW_ATTACK (9 + N_TWEAKS)
+#define CMD_SUPERSAW_RELEASE (10 + N_TWEAKS)
+#define CMD_SUPERSAW_SMOOTH (11 + N_TWEAKS)
+
+// The delay line is sized for the longest delay these allow.
+#define DELAY_MIN_BPM (40)
+#define DELAY_MAX_BPM (300)
+#define DELAY_MAX_REPEATS (8)
+
+struct Command {
+  int whistler;  // for CMD_VOICE, CMD_VOLUME, and CMD_GATE
+  int type;
+  int value;
+  float amount;
+};
+
+// Queue a parameter change for the audio thread, which applies it at the
+// start of the next block.  Lock-free and wait-free, but only one thread may
+// send at a time.  Returns 0 if the queue is full, or if the command is out
+// of range: a whistler that isn't running, a voice that isn't a slot, a
+// volume or gate outside 0-9, and so on.  Those are dropped.
+int send_command(int whistler, int type, int value, float amount);
+
+// Process frames of synth_channels() interleaved channels: each whistler's
+// input goes through its octaver, and the delay's through the delay.
+void process_frames(const float* in, float* out, int frames);
+
+// Run n samples of whistle input through whistler's octaver, without any of
+// the output processing.
+void update_block(int whistler, const float* in, float* out, int n);
+
+// What the octaver hears, for driving other synths.  Onsets and offsets are
+// the gate opening and closing; while it's open, each block with a crossing
+// in the voice's range gives a pitch.
+#define EVENT_ONSET 0
+#define EVENT_OFFSET 1
+#define EVENT_PITCH 2
+
+struct Event {
+  int type;
+  unsigned int time;  // in samples, since set_params(); wraps after a day
+  float period;  // in samples; only for EVENT_PITCH
+  float amplitude;  // RMS of the last few ms of input
+};
+
+// Take the oldest event whistler has published, returning 0 if there are
+// none.  Lock-free, for one thread at a time; whistlers drop events when
+// nobody takes them.
+int next_event(int whistler, struct Event* event);
+
+// The period, in samples, whistler's octaver last started oscillators for
+// (or would have, if it was in the voice's range), for zeros-bench.
+float input_period(int whistler);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
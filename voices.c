@@ -0,0 +1,440 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "oscbank.h"
+#include "synth.h"
+#include "voices.h"
+
+// The pitches, in Hz, the octaver accepts from a whistle and from a voice.
+#define WHISTLE_RANGE_HIGH (3150)
+#define VOCAL_RANGE_HIGH (882)
+#define WHISTLE_RANGE_LOW (588)
+#define VOCAL_RANGE_LOW (147)
+
+// Output smoothing cutoffs, in Hz.
+#define SMOOTHING_HIGH (740)
+#define SMOOTHING_MEDIUM (214)
+#define SMOOTHING_LOW (70.5)
+
+#define TRUE 1
+#define FALSE 0
+
+struct Voice voices[N_VOICES] = {
+  [V_SOPRANO_RECORDER] = {
+    .name = "soprano-recorder",
+    .gain = 0.2, .ungain = 1, .smoothing = SMOOTHING_HIGH,
+    .range_high = WHISTLE_RANGE_HIGH, .range_low = WHISTLE_RANGE_LOW,
+    .n_oscs = 1,
+    .oscs = {
+      {.vol = 0.5, .mode = OSC_NAT, .lfo_is_volume = TRUE,
+       .speed = 0.5, .cycle = 1, .mod = 2},
+    },
+  },
+  [V_BASS_FLUTE] = {
+    .name = "bass-flute",
+    .gain = 0.3, .ungain = 1, .smoothing = SMOOTHING_HIGH,
+    .range_high = WHISTLE_RANGE_HIGH, .range_low = WHISTLE_RANGE_LOW,
+    .n_oscs = 3,
+    .oscs = {
+      {.vol = 0.5, .mode = OSC_SIN, .lfo_is_volume = TRUE,
+       .speed = 1.0/4, .cycle = 1.0/4, .mod = 2},
+      {.vol = 0.2, .mode = OSC_SIN, .lfo_is_volume = TRUE,
+       .speed = 2.0/4, .cycle = 2.0/4, .mod = 2},
+      {.vol = 0.2, .mode = OSC_SIN, .lfo_is_volume = TRUE,
+       .speed = 3.0/4, .cycle = 3.0/4, .mod = 2},
+    },
+  },
+  [V_DIST] = {
+    .name = "dist",
+    .gain = 0.125, .ungain = 1, .smoothing = SMOOTHING_HIGH,
+    .range_high = WHISTLE_RANGE_HIGH, .range_low = WHISTLE_RANGE_LOW,
+    .distort = SHAPE_FUZZ,
+    .n_oscs = 1,
+    .oscs = {
+      {.vol = 0.5, .mode = OSC_SQR, .lfo_is_volume = TRUE,
+       .speed = 0.5, .cycle = 1, .mod = 2},
+    },
+  },
+  [V_REED] = {
+    .name = "reed",
+    .gain = 0.3, .ungain = 1, .smoothing = SMOOTHING_HIGH,
+    .range_high = WHISTLE_RANGE_HIGH, .range_low = WHISTLE_RANGE_LOW,
+    .n_oscs = 1,
+    .oscs = {
+      {.vol = 0.5, .mode = OSC_NAT, .lfo_is_volume = TRUE,
+       .speed = 0.25, .cycle = 1.0/4, .mod = 2},
+    },
+  },
+  [V_FLUTE] = {
+    .name = "flute",
+    .gain = 0.3, .ungain = 1, .smoothing = SMOOTHING_HIGH,
+    .range_high = WHISTLE_RANGE_HIGH, .range_low = WHISTLE_RANGE_LOW,
+    .n_oscs = 5,
+    .oscs = {
+      {.vol = 0.5, .mode = OSC_SIN, .lfo_is_volume = TRUE,
+       .speed = 0.5, .cycle = 1.0/2, .mod = 2},
+      {.vol = 0.15, .mode = OSC_SIN, .lfo_is_volume = TRUE,
+       .speed = 0.53, .cycle = 2.0/2, .mod = 2},
+      {.vol = 0.15, .mode = OSC_SIN, .lfo_is_volume = TRUE,
+       .speed = 0.48, .cycle = 2.0/2, .mod = 2},
+      {.vol = 0.15, .mode = OSC_SIN, .lfo_is_volume = TRUE,
+       .speed = 0.51, .cycle = 3.0/2, .mod = 2},
+      {.vol = 0.15, .mode = OSC_SIN, .lfo_is_volume = TRUE,
+       .speed = 0.49, .cycle = 3.0/2, .mod = 2},
+    },
+  },
+  [V_EBASS] = {
+    .name = "ebass",
+    .gain = 0.25, .ungain = 1, .smoothing = SMOOTHING_LOW,
+    .range_high = WHISTLE_RANGE_HIGH, .range_low = WHISTLE_RANGE_LOW,
+    .n_oscs = 6,
+    .oscs = {
+      {.vol = 0.2, .mode = OSC_SIN, .lfo_is_volume = FALSE,
+       .speed = 1.0/32, .cycle = 8.0/16, .mod = 2},
+      {.vol = 0.24, .mode = OSC_SIN, .lfo_is_volume = FALSE,
+       .speed = 2.0/32, .cycle = 2.0/16, .mod = 2},
+      {.vol = 0.14, .mode = OSC_SIN, .lfo_is_volume = FALSE,
+       .speed = 3.11/32, .cycle = 3.0/16, .mod = 2},
+      {.vol = 0.14, .mode = OSC_SIN, .lfo_is_volume = FALSE,
+       .speed = 4.3/32, .cycle = 4.0/16, .mod = 2},
+      {.vol = 0.06, .mode = OSC_SIN, .lfo_is_volume = FALSE,
+       .speed = 5.7/32, .cycle = 5.0/16, .mod = 2},
+      {.vol = 0.06, .mode = OSC_SIN, .lfo_is_volume = FALSE,
+       .speed = 6.1/32, .cycle = 6.0/16, .mod = 2},
+    },
+  },
+  [V_VOCAL_2] = {
+    .name = "vocal-2",
+    .gain = 0.25, .ungain = 0.5, .smoothing = SMOOTHING_HIGH,
+    .range_high = VOCAL_RANGE_HIGH, .range_low = VOCAL_RANGE_LOW,
+    .n_oscs = 1,
+    .oscs = {
+      {.vol = 0.4, .mode = OSC_NAT, .lfo_is_volume = TRUE,
+       .speed = 0.5, .cycle = 0.5, .mod = 2},
+    },
+  },
+  [V_VOCAL_1] = {
+    .name = "vocal-1",
+    .gain = 0.09, .ungain = 1, .smoothing = SMOOTHING_HIGH,
+    .range_high = VOCAL_RANGE_HIGH, .range_low = VOCAL_RANGE_LOW,
+    .n_oscs = 1,
+    .oscs = {
+      {.vol = 0.4, .mode = OSC_NAT, .lfo_is_volume = TRUE,
+       .speed = 0.5, .cycle = 1, .mod = 2},
+    },
+  },
+  [V_RAW] = {
+    .name = "raw",
+    .gain = 0.125, .ungain = 0.7, .smoothing = SMOOTHING_HIGH,
+    .range_high = WHISTLE_RANGE_HIGH, .range_low = WHISTLE_RANGE_LOW,
+    .raw = TRUE,
+  },
+  [V_RAWDIST] = {
+    .name = "rawdist",
+    .gain = 0.5, .ungain = 0.25, .smoothing = SMOOTHING_HIGH,
+    .range_high = WHISTLE_RANGE_HIGH, .range_low = WHISTLE_RANGE_LOW,
+    .raw = TRUE,
+    .distort = SHAPE_FUZZ,
+  },
+  // What zeros.ino played before it used this engine: four octaves down,
+  // ringing for nine crossings.
+  [V_DEEP_SINE] = {
+    .name = "deep-sine",
+    .gain = 1/3.0, .ungain = 1, .smoothing = SMOOTHING_LOW,
+    .range_high = WHISTLE_RANGE_HIGH, .range_low = WHISTLE_RANGE_LOW,
+    .duration = 9, .every = 2,
+    .n_oscs = 1,
+    .oscs = {
+      {.vol = 0.12, .mode = OSC_SIN, .speed = 1/16.0, .cycle = 1/2.0, .mod = 4},
+    },
+  },
+  // What the browser version plays.  It has its own envelope, so no output
+  // smoothing.
+  [V_SUPERSAW] = {
+    .name = "supersaw",
+    .gain = 1, .ungain = 1, .smoothing = 0,
+    .range_high = WHISTLE_RANGE_HIGH, .range_low = WHISTLE_RANGE_LOW,
+    .supersaw = {.saws = 7, .detune_cents = 40, .octave_shift = 2,
+                 .attack_ms = 30, .release_ms = 100, .pitch_smooth = 0.1},
+  },
+};
+
+/*******************************************************************/
+
+// Accepts plain numbers and fractions like 3.11/32.
+int parse_number(const char* s, float* out) {
+  char* end;
+  double v = strtod(s, &end);
+  if (end == s) {
+    return FALSE;
+  }
+  if (*end == '/') {
+    const char* denominator = end + 1;
+    double d = strtod(denominator, &end);
+    if (end == denominator || d == 0) {
+      return FALSE;
+    }
+    v /= d;
+  }
+  if (*end != '\0') {
+    return FALSE;
+  }
+  *out = v;
+  return TRUE;
+}
+
+int parse_voice_key(struct Voice* voice, const char* key, const char* s) {
+  if (strcmp(key, "pitch") == 0) {
+    if (strcmp(s, "crossings") == 0) {
+      voice->pitch = PITCH_CROSSINGS;
+    } else if (strcmp(s, "mpm") == 0) {
+      voice->pitch = PITCH_MPM;
+    } else {
+      return FALSE;
+    }
+    return TRUE;
+  }
+  if (strcmp(key, "distort") == 0) {
+    if (strcmp(s, "clip") == 0) {
+      voice->distort = SHAPE_CLIP;
+      return TRUE;
+    } else if (strcmp(s, "fuzz") == 0) {
+      voice->distort = SHAPE_FUZZ;
+      return TRUE;
+    } else if (strcmp(s, "soft") == 0) {
+      voice->distort = SHAPE_SOFT;
+      return TRUE;
+    }
+  }
+
+  float value;
+  if (!parse_number(s, &value)) {
+    return FALSE;
+  }
+  if (strcmp(key, "gain") == 0) {
+    voice->gain = value;
+  } else if (strcmp(key, "ungain") == 0) {
+    voice->ungain = value;
+  } else if (strcmp(key, "smoothing") == 0) {
+    if (value < 0) {
+      return FALSE;
+    }
+    voice->smoothing = value;
+  } else if (strcmp(key, "range_high") == 0) {
+    if (value <= 0) {
+      return FALSE;
+    }
+    voice->range_high = value;
+  } else if (strcmp(key, "range_low") == 0) {
+    if (value <= 0) {
+      return FALSE;
+    }
+    voice->range_low = value;
+  } else if (strcmp(key, "raw") == 0) {
+    voice->raw = value != 0;
+  } else if (strcmp(key, "distort") == 0) {
+    if (value < 0 || value >= N_SHAPES) {
+      return FALSE;
+    }
+    voice->distort = value;
+  } else if (strcmp(key, "oversample") == 0) {
+    if (value != 1 && value != 2 && value != 4) {
+      return FALSE;
+    }
+    voice->oversample = value;
+  } else if (strcmp(key, "duration") == 0) {
+    if (value < 1 || value > MAX_DURATION) {
+      return FALSE;
+    }
+    voice->duration = value;
+  } else if (strcmp(key, "every") == 0) {
+    if (value < 1) {
+      return FALSE;
+    }
+    voice->every = value;
+  } else if (strcmp(key, "saws") == 0) {
+    if (value < 1 || value > SUPERSAW_MAX_SAWS || (int)value % 2 == 0) {
+      return FALSE;
+    }
+    voice->supersaw.saws = value;
+  } else if (strcmp(key, "detune") == 0) {
+    if (value < 0 || value > 1200) {
+      return FALSE;
+    }
+    voice->supersaw.detune_cents = value;
+  } else if (strcmp(key, "octaves") == 0) {
+    if (value < 0 || value > SUPERSAW_MAX_OCTAVES) {
+      return FALSE;
+    }
+    voice->supersaw.octave_shift = value;
+  } else if (strcmp(key, "attack") == 0) {
+    if (value < 0) {
+      return FALSE;
+    }
+    voice->supersaw.attack_ms = value;
+  } else if (strcmp(key, "release") == 0) {
+    if (value < 0) {
+      return FALSE;
+    }
+    voice->supersaw.release_ms = value;
+  } else if (strcmp(key, "smooth") == 0) {
+    if (value <= 0 || value > 1) {
+      return FALSE;
+    }
+    voice->supersaw.pitch_smooth = value;
+  } else {
+    return FALSE;
+  }
+  return TRUE;
+}
+
+int parse_osc_key(struct OscDesign* osc, const char* key, const char* s) {
+  if (strcmp(key, "mode") == 0) {
+    if (strcmp(s, "nat") == 0) {
+      osc->mode = OSC_NAT;
+    } else if (strcmp(s, "sqr") == 0) {
+      osc->mode = OSC_SQR;
+    } else if (strcmp(s, "sin") == 0) {
+      osc->mode = OSC_SIN;
+    } else {
+      return FALSE;
+    }
+    return TRUE;
+  }
+
+  float value;
+  if (!parse_number(s, &value)) {
+    return FALSE;
+  }
+  if (strcmp(key, "vol") == 0) {
+    osc->vol = value;
+  } else if (strcmp(key, "speed") == 0) {
+    osc->speed = value;
+  } else if (strcmp(key, "cycle") == 0) {
+    osc->cycle = value;
+  } else if (strcmp(key, "mod") == 0) {
+    osc->mod = value;
+  } else if (strcmp(key, "lfo_rate") == 0) {
+    osc->lfo_rate = value;
+  } else if (strcmp(key, "lfo_amplitude") == 0) {
+    osc->lfo_amplitude = value;
+  } else if (strcmp(key, "lfo_is_volume") == 0) {
+    osc->lfo_is_volume = value != 0;
+  } else {
+    return FALSE;
+  }
+  return TRUE;
+}
+
+int load_voices(const char* fname) {
+  FILE* file = fopen(fname, "r");
+  if (!file) {
+    perror("can't open voices file");
+    fprintf(stderr, "  in: %s\n", fname);
+    return FALSE;
+  }
+
+  // Parse into a scratch copy, so a bad file leaves the table alone.
+  static struct Voice parsed[N_VOICES];
+  memcpy(parsed, voices, sizeof(parsed));
+
+  struct Voice* voice = NULL;
+  char line[512];
+  int line_number = 0;
+  while (fgets(line, sizeof(line), file)) {
+    line_number++;
+    char* comment = strchr(line, '#');
+    if (comment) {
+      *comment = '\0';
+    }
+
+    char* tokens[32];
+    int n_tokens = 0;
+    for (char* token = strtok(line, " \t\r\n"); token && n_tokens < 32;
+         token = strtok(NULL, " \t\r\n")) {
+      tokens[n_tokens++] = token;
+    }
+    if (n_tokens == 0) {
+      continue;
+    }
+
+    const char* error = NULL;
+    int first_key = 1;
+    int is_voice_line = strcmp(tokens[0], "voice") == 0;
+    if (is_voice_line) {
+      int slot = n_tokens > 1 ? atoi(tokens[1]) : -1;
+      if (n_tokens < 3 || !isdigit((unsigned char)tokens[1][0]) ||
+          slot < 0 || slot >= N_VOICES) {
+        error = "expected: voice <slot> <name> [key=value ...]";
+      } else {
+        voice = &parsed[slot];
+        memset(voice, 0, sizeof(*voice));
+        snprintf(voice->name, sizeof(voice->name), "%s", tokens[2]);
+        voice->gain = 0.25;
+        voice->ungain = 1;
+        voice->smoothing = SMOOTHING_HIGH;
+        voice->range_high = WHISTLE_RANGE_HIGH;
+        voice->range_low = WHISTLE_RANGE_LOW;
+        voice->supersaw.detune_cents = 40;
+        voice->supersaw.octave_shift = 2;
+        voice->supersaw.attack_ms = 30;
+        voice->supersaw.release_ms = 100;
+        voice->supersaw.pitch_smooth = 0.1;
+        first_key = 3;
+      }
+    } else if (strcmp(tokens[0], "osc") == 0) {
+      if (!voice) {
+        error = "osc before any voice";
+      } else if (voice->n_oscs >= N_OSCS_PER_LAYER) {
+        error = "too many oscs for one voice";
+      } else {
+        struct OscDesign* osc = &voice->oscs[voice->n_oscs++];
+        osc->vol = 0.5;
+        osc->mode = OSC_NAT;
+        osc->lfo_is_volume = TRUE;
+        osc->speed = 0.5;
+        osc->cycle = 1;
+        osc->mod = 2;
+      }
+    } else {
+      error = "expected voice or osc";
+    }
+
+    for (int i = first_key; !error && i < n_tokens; i++) {
+      char* equals = strchr(tokens[i], '=');
+      if (!equals) {
+        error = "expected key=value";
+        break;
+      }
+      *equals = '\0';
+      const char* value_string = equals + 1;
+      if (is_voice_line) {
+        if (!parse_voice_key(voice, tokens[i], value_string)) {
+          error = "bad voice setting";
+        }
+      } else if (!parse_osc_key(&voice->oscs[voice->n_oscs - 1],
+                                tokens[i], value_string)) {
+        error = "bad osc setting";
+      }
+    }
+
+    if (!error && voice && voice->range_high <= voice->range_low) {
+      error = "range_high must be above range_low";
+    }
+    if (!error && !is_voice_line &&
+        voice->oscs[voice->n_oscs - 1].lfo_amplitude > 0 &&
+        voice->oscs[voice->n_oscs - 1].lfo_rate <= 0) {
+      error = "an lfo needs a positive lfo_rate";
+    }
+    if (error) {
+      fprintf(stderr, "%s:%d: %s\n", fname, line_number, error);
+      fclose(file);
+      return FALSE;
+    }
+  }
+  fclose(file);
+
+  memcpy(voices, parsed, sizeof(parsed));
+  return TRUE;
+}
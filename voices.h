@@ -0,0 +1,99 @@
+// Voice designs: how the octaver's oscillators are configured for each voice.
+//
+// The built-in voices are compiled in, and a config file can replace them or
+// fill the empty slots at startup.  After that the table doesn't change; live
+// adjustments go through the tweaks in synth.c.
+
+#ifndef VOICES_H
+#define VOICES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define N_VOICES 16  // slots; the keypad reaches 0-9, OSC all of them
+#define N_OSCS_PER_LAYER 6  // max oscillators per voice
+
+#define OSC_NAT 0
+#define OSC_SQR 1
+#define OSC_SIN 2
+
+// How saturation shapes the output; see shaper.h.
+#define SHAPE_CLIP 0  // only clip to [-1, 1]
+#define SHAPE_FUZZ 1
+#define SHAPE_SOFT 2  // tanh
+#define N_SHAPES 3
+
+// How the octaver finds the input's period; see pitch.h.
+#define PITCH_CROSSINGS 0  // time between zero crossings
+#define PITCH_MPM 1  // McLeod pitch method
+
+struct OscDesign {
+  float vol;
+  int mode;
+  float lfo_rate;  // Hz
+  float lfo_amplitude;
+  char lfo_is_volume;  // either affects volume or speed
+  float speed;
+  float cycle;
+  int mod;
+};
+
+// A supersaw plays detuned band-limited saws at the input's pitch, instead of
+// the oscillators above; see supersaw.h.
+#define SUPERSAW_MAX_SAWS 15
+#define SUPERSAW_MAX_OCTAVES 4
+
+struct SupersawDesign {
+  int saws;  // odd, up to SUPERSAW_MAX_SAWS; 0 if this isn't a supersaw
+  float detune_cents;  // between the middle saw and the outermost
+  int octave_shift;  // octaves below the input, up to SUPERSAW_MAX_OCTAVES
+  float attack_ms;
+  float release_ms;
+  // How far to move towards each new period, per sample at
+  // DEFAULT_SAMPLE_RATE; other rates glide over the same time.
+  float pitch_smooth;
+};
+
+struct Voice {
+  char name[32];  // empty if this slot has no voice
+  float gain;
+  float ungain;
+  float smoothing;  // output smoothing cutoff, in Hz; 0 for none
+  float range_high;  // highest accepted input pitch, in Hz
+  float range_low;  // lowest accepted input pitch, in Hz
+  char raw;  // pass input straight through instead of octaving
+  int distort;  // SHAPE_*
+  int oversample;  // run the shaping at 2 or 4 times the sample rate; 0 or 1 to not
+  int pitch;  // PITCH_*
+  int duration;  // crossings each oscillator sounds for; 0 for DURATION
+  int every;  // start oscillators on every this many crossings; 0 for 1
+  int n_oscs;
+  struct OscDesign oscs[N_OSCS_PER_LAYER];
+  struct SupersawDesign supersaw;
+};
+
+extern struct Voice voices[N_VOICES];
+
+// Reads voice definitions from a file, replacing any built-in voices in the
+// same slots.  The format is one voice line followed by its osc lines:
+//
+//   # comment
+//   voice <slot> <name> [key=value ...]
+//     osc [key=value ...]
+//
+// Voice keys: gain, ungain, smoothing (Hz), range_high and range_low (Hz),
+// raw, distort (clip, fuzz, soft, or 0-2), oversample (1, 2, 4), pitch
+// (crossings, mpm), duration (1-9), every, and for a supersaw instead of
+// oscs, saws (odd, up to 15), detune (cents), octaves (0-4), attack and
+// release (ms), and smooth.
+// Osc keys: vol, mode (nat, sqr, sin), speed, cycle, mod, lfo_rate (Hz),
+// lfo_amplitude, lfo_is_volume.  Numbers may be written as fractions, like
+// 3/16.  Returns 0, after printing why, if the file can't be used.
+int load_voices(const char* fname);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,118 @@
+// The browser's way into the engine: `make html/zeros.wasm` builds this and
+// the engine into a standalone WebAssembly module, with no JavaScript glue,
+// for an AudioWorklet to instantiate.
+//
+// Each render quantum, the worklet writes its input into the buffer at
+// wasm_input(), calls wasm_process(), and reads the result from the buffer
+// at wasm_output(), as Float32Array views on the module's memory.  Frames
+// are interleaved as for process_frames(): the whistle on channel 0, and
+// channel 1 silent, since the browser build has no delay.  It's built with
+// 128-bit SIMD, which the engine's vector code compiles straight to.
+//
+// The browser plays the supersaw, set up from its sliders by
+// wasm_configure().
+
+#include "synth.h"
+
+#define WASM_CHANNELS (2)
+
+float wasm_in[FRAMES_PER_BUFFER * WASM_CHANNELS];
+float wasm_out[FRAMES_PER_BUFFER * WASM_CHANNELS];
+
+// The page's volume slider is continuous, so rather than pick one of the
+// engine's volumes, we leave that at 1 and send the slider as the supersaw's
+// gain tweak, which applies before the engine clips.
+#define WASM_VOLUME 9
+#define WASM_GATE 4
+
+// What the sliders last asked for, and what we've sent the engine.  Silent
+// until the page first configures us.
+float wanted_volume = 0;
+float sent_volume = 1;
+int wanted_gate = WASM_GATE;
+int sent_gate = WASM_GATE;
+struct SupersawDesign wanted_supersaw;
+struct SupersawDesign sent_supersaw;
+
+// sample_rate is the AudioContext's, whatever the browser gave it.
+void wasm_init(float sample_rate) {
+  set_sample_rate(sample_rate);
+  set_delay_enabled(0);
+  init_synth();
+  set_params(0, V_SUPERSAW, WASM_VOLUME, WASM_GATE);
+  wanted_supersaw = sent_supersaw = voices[V_SUPERSAW].supersaw;
+}
+
+float* wasm_input() {
+  return wasm_in;
+}
+
+float* wasm_output() {
+  return wasm_out;
+}
+
+// Slider changes can come in faster than quanta, so rather than send a
+// command for each, we send one per setting per quantum, for whatever
+// changed, and the command queue never fills.
+void send_changes() {
+  struct SupersawDesign* want = &wanted_supersaw;
+  struct SupersawDesign* sent = &sent_supersaw;
+  if (wanted_volume != sent_volume) {
+    send_command(0, CMD_TWEAK_GAIN, V_SUPERSAW, wanted_volume);
+  }
+  if (wanted_gate != sent_gate) {
+    send_command(0, CMD_GATE, wanted_gate, 0);
+  }
+  if (want->saws != sent->saws) {
+    send_command(0, CMD_SUPERSAW_SAWS, V_SUPERSAW, want->saws);
+  }
+  if (want->detune_cents != sent->detune_cents) {
+    send_command(0, CMD_SUPERSAW_DETUNE, V_SUPERSAW, want->detune_cents);
+  }
+  if (want->octave_shift != sent->octave_shift) {
+    send_command(0, CMD_SUPERSAW_OCTAVES, V_SUPERSAW, want->octave_shift);
+  }
+  if (want->attack_ms != sent->attack_ms) {
+    send_command(0, CMD_SUPERSAW_ATTACK, V_SUPERSAW, want->attack_ms);
+  }
+  if (want->release_ms != sent->release_ms) {
+    send_command(0, CMD_SUPERSAW_RELEASE, V_SUPERSAW, want->release_ms);
+  }
+  if (want->pitch_smooth != sent->pitch_smooth) {
+    send_command(0, CMD_SUPERSAW_SMOOTH, V_SUPERSAW, want->pitch_smooth);
+  }
+  sent_volume = wanted_volume;
+  sent_gate = wanted_gate;
+  *sent = *want;
+}
+
+// frames is at most FRAMES_PER_BUFFER.
+void wasm_process(int frames) {
+  send_changes();
+  process_frames(wasm_in, wasm_out, frames);
+}
+
+// volume multiplies the output before it's clipped, gate is 0-9, and saws
+// odd, up to SUPERSAW_MAX_SAWS.
+void wasm_configure(float volume, int gate, int saws, float detune_cents,
+                    int octave_shift, float attack_ms, float release_ms,
+                    float pitch_smooth) {
+  wanted_volume = volume;
+  wanted_gate = gate;
+  wanted_supersaw.saws = saws;
+  wanted_supersaw.detune_cents = detune_cents;
+  wanted_supersaw.octave_shift = octave_shift;
+  wanted_supersaw.attack_ms = attack_ms;
+  wanted_supersaw.release_ms = release_ms;
+  wanted_supersaw.pitch_smooth = pitch_smooth;
+}
+
+void wasm_set_params(int voice, int volume, int gate) {
+  set_params(0, voice, volume, gate);
+}
+
+// For changes while audio is running.  The worklet's message handler runs
+// on the audio thread, between quanta, so it's the only sender.
+int wasm_send_command(int type, int value, float amount) {
+  return send_command(0, type, value, amount);
+}
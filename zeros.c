@@ -45,12 +45,22 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <libgen.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 #include "portaudio.h"
+#include "lo/lo.h"
 
-#define SAMPLE_RATE       (44100)    // if you change this, change MIN/MAX_INPUT_PERIOD too
-#define FRAMES_PER_BUFFER   (128)    // this is low, to minimize latency
+#include "synth.h"
 
 /* Select sample format. */
 #define PA_SAMPLE_TYPE  paFloat32
@@ -58,35 +68,11 @@
 #define SAMPLE_SILENCE  (0.0f)
 #define PRINTF_S_FORMAT "%.8f"
 
-#define WHISTLE_RANGE_HIGH (14)
-#define VOCAL_RANGE_HIGH (50)
-#define WHISTLE_RANGE_LOW (75)
-#define VOCAL_RANGE_LOW (300)
-#define SLIDE (4)
-// We amplify in two stages: first gain, then saturate, then volume.  This lets
-// us get the effect of saturation/clipping independent of the output volume.
-#define GAIN (1.0)
-#define VOLUME (1.0)
-#define DURATION (3)
-
-#define GATE_SQUARED (0.01*0.01)
-#define RECENT_GATE_SQUARED (40*40*GATE_SQUARED)
-//#define GRACE_TICKS (44100)
-
-#define HISTORY_LENGTH (8192)
-#define RECENT_LENGTH (256)
-
 #define BOOL char
 #define TRUE 1
 #define FALSE 0
 
-#define OSC_NAT 0
-#define OSC_SQR 1
-#define OSC_SIN 2
-
-#define DURATION_UNITS (400) // samples
-#define DURATION_BLOCKS (100) // in DURATION_UNITS
-#define DURATION_MAX_VAL (0.04)
+#define DEFAULT_OSC_PORT "9000"
 
 //#define USB_SOUND_CARD_PREFIX "USB Audio Device"
 #define USB_SOUND_CARD_PREFIX "Scarlett"
@@ -98,765 +84,831 @@ void die(char *errmsg) {
   exit(-1);
 }
 
-float duration_hist[DURATION_BLOCKS];
-int duration_pos = 0;
-float duration_current_total = 0;
-int duration_current_count = 0;
-float duration_val = 0;
-void update_duration(float sample) {
-  duration_current_total += fabs(sample);
-  duration_current_count++;
-  if (duration_current_count > DURATION_UNITS) {
-    float val = duration_current_total / duration_current_count;
-    duration_current_total = 0;
-    duration_current_count = 0;
-    duration_hist[(++duration_pos) % DURATION_BLOCKS] = val;
-
-    duration_val = 0;
-    float block_min = -1;
-    for (int i = 0; i < DURATION_BLOCKS; i++) {
-      float histval =
-	duration_hist[(DURATION_BLOCKS + duration_pos - i)%DURATION_BLOCKS];
-      if (block_min < 0 || histval < block_min) {
-	block_min = histval;
-      }
-      duration_val += block_min;
-    }
-    duration_val = fminf(duration_val/DURATION_BLOCKS, DURATION_MAX_VAL);
-    //printf("%.2f\n", duration_val);
-  }
-}
 
+// The command queue takes one producer at a time, and both the file watcher
+// and the OSC server send commands.
+pthread_mutex_t command_mutex = PTHREAD_MUTEX_INITIALIZER;
+BOOL queue_command(int whistler, int type, int value, float amount) {
+  pthread_mutex_lock(&command_mutex);
+  BOOL ok = send_command(whistler, type, value, amount);
+  pthread_mutex_unlock(&command_mutex);
+  return ok;
+}
 
-struct Octaver {
-  float hist[HISTORY_LENGTH];
-  int hist_pos;
-  long long cycles;
-  float samples_since_last_crossing;
-  float samples_since_attack_began;
-  BOOL positive;
-  float previous_sample;
-  float rough_input_period;
-  float hist_sq;
-  float recent_hist_sq;
+struct int_from_file {
+  const char* purpose;
+  const char* fname;
+  FILE* file;
+  int value;
+  int command;
 };
 
-struct Octaver octaver;
-
-void init_octaver() {
-  for (int i = 0; i < HISTORY_LENGTH; i++) {
-    octaver.hist[i] = 0;
-  }
-  octaver.cycles = 0;
-  octaver.hist_pos = 0;
+struct int_from_file voice_iff;
+struct int_from_file volume_iff;
+struct int_from_file gate_iff;
 
-  octaver.samples_since_last_crossing = 0;
-  octaver.samples_since_attack_began = 0;
+#define N_IFFS 3
+struct int_from_file* iffs[N_IFFS] = {&voice_iff, &volume_iff, &gate_iff};
 
-  octaver.positive = TRUE;
-  octaver.previous_sample = 0;
-  octaver.rough_input_period = 40;
-  octaver.hist_sq = 0;
-  octaver.recent_hist_sq = 0;
+int read_number(FILE* file) {
+  char buf[16];
+  rewind(file);
+  int bytesRead = fread(buf, 1, 16, file);
+  if (bytesRead > 15) {
+    bytesRead = 15;
+  }
+  buf[bytesRead] = '\0';
+  return atoi(buf);
 }
 
-void set_hist(float s) {
-  octaver.hist_sq += (s*s);
-  octaver.hist_sq -= (octaver.hist[octaver.hist_pos] *
-                      octaver.hist[octaver.hist_pos]);
-
-  octaver.recent_hist_sq += (s*s);
-  int recent_pos = (octaver.hist_pos - RECENT_LENGTH +
-                    HISTORY_LENGTH) % HISTORY_LENGTH;
-  octaver.recent_hist_sq -= (octaver.hist[recent_pos] *
-                             octaver.hist[recent_pos]);
-
-  octaver.hist[octaver.hist_pos] = s;
-  octaver.hist_pos = (octaver.hist_pos + 1) % HISTORY_LENGTH;
+void open_iff_or_die(struct int_from_file* iff) {
+  iff->file = fopen(iff->fname, "r");
+  if (!iff->file) {
+    perror("can't open file");
+    fprintf(stderr, "  in: %s", iff->fname);
+    exit(-1);
+  }
+  return;
 }
 
-float get_hist(int pos) {
-  return octaver.hist[
-    (HISTORY_LENGTH + octaver.hist_pos - pos) % HISTORY_LENGTH];
+// The audio thread doesn't check what it's sent, so we must: a voice must be
+// a slot with a voice in it, and a volume or gate 0-9.
+BOOL param_in_range(int type, int value) {
+  int max = type == CMD_VOICE ? N_VOICES - 1 : 9;
+  return value >= 0 && value <= max &&
+    (type != CMD_VOICE || voices[value].name[0]);
 }
 
-float hist_squared_sum() {
-  float s = 0;
-  for (int i = 0; i < HISTORY_LENGTH; i++) {
-    s += (octaver.hist[i] * octaver.hist[i]);
+// Returns FALSE if the command queue was full, in which case we need to try
+// again later.  Unless forced, only sends a command if the value changed.
+// Out of range values are reported once and otherwise ignored.
+BOOL update_iff(struct int_from_file* iff, BOOL force) {
+  rewind(iff->file);
+  int new_value = read_number(iff->file);
+  if (iff->value == new_value && !force) {
+    return TRUE;
+  }
+  if (!param_in_range(iff->command, new_value)) {
+    if (iff->value != new_value) {
+      printf("%s: %d out of range\n", iff->purpose, new_value);
+    }
+    iff->value = new_value;
+    return TRUE;
+  }
+  if (!queue_command(0, iff->command, new_value, 0)) {
+    return FALSE;
+  }
+  if (iff->value != new_value) {
+    printf("%s: %d -> %d\n", iff->purpose, iff->value, new_value);
   }
-  return s;
+  iff->value = new_value;
+  return TRUE;
 }
 
-// Only called when octaver.hist_pos = HISTORY_LENGTH-1
-float recent_hist_squared_sum() {
-  float s = 0;
-  for (int i = HISTORY_LENGTH - RECENT_LENGTH; i < HISTORY_LENGTH; i++) {
-    s += (octaver.hist[i] * octaver.hist[i]);
+void poll_iffs() {
+  while (1) {
+    for (int i = 0; i < N_IFFS; i++) {
+      update_iff(iffs[i], FALSE);
+    }
+    usleep(50000 /* 50ms in us */);
   }
-  return s;
 }
 
-struct Osc {
-  BOOL active;
-  float amp;
-  float pos;
-  int samples;
-  float total_amplitude;
-  int duration;
-
-  int mode;
-  float speed;
-  float polarity;
-  float vol;
-
-  float lfo_pos;
-  float lfo_rate;
-  float lfo_amplitude;
-  BOOL lfo_is_volume;  // either affects volume or speed
-
-  float rough_input_period;
-};
-
-void osc_init(
-    struct Osc* osc, long long cycles, float adjustment, float vol,
-    int mode, float lfo_rate, float lfo_amplitude,
-    BOOL lfo_is_volume, float speed, float cycle, int mod) {
-
-  osc->active = TRUE;
-  osc->amp = 0;
-  osc->pos = -adjustment;
-  osc->samples = 0;
-  osc->total_amplitude = 0;
-  osc->duration = DURATION;
-
-  osc->lfo_rate = lfo_rate;
-  osc->lfo_amplitude = lfo_amplitude;
-  osc->lfo_is_volume = lfo_is_volume;
-
-  osc->mode = mode;
-  osc->speed = speed;
-  if (mod == 0) {
-    osc->polarity = 1;
-  } else {
-    osc->polarity = ((int)(cycle * cycles)) % mod ? 1 : -1;
+#ifdef __linux__
+// Sleep until the kernel tells us one of our files was rewritten, instead of
+// waking up 20 times a second to check.  We watch the directories rather than
+// the files so we also see files that are replaced by a rename.  Returns only
+// if inotify fails.
+void watch_iffs() {
+  int fd = inotify_init1(IN_CLOEXEC);
+  if (fd < 0) {
+    perror("inotify unavailable, polling instead");
+    return;
   }
-  osc->vol = vol;
 
-  osc->rough_input_period = octaver.rough_input_period;
-}
+  const char* basenames[N_IFFS];
+  for (int i = 0; i < N_IFFS; i++) {
+    char* dir = strdup(iffs[i]->fname);
+    const char* slash = strrchr(iffs[i]->fname, '/');
+    basenames[i] = slash ? slash + 1 : iffs[i]->fname;
+    if (inotify_add_watch(fd, slash ? dirname(dir) : ".",
+                          IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+      perror("can't watch directory, polling instead");
+      free(dir);
+      close(fd);
+      return;
+    }
+    free(dir);
+  }
 
-void osc_diff(struct Osc* osc1, struct Osc* osc2) {
-  if (osc1->pos != osc2->pos) {
-    printf("pos mismatch %.5f %.5f\n", osc1->pos, osc2->pos);
+  // Files that were written but whose new value we haven't sent yet.  Send
+  // even if the value looks unchanged, since OSC may have changed it since we
+  // last read it.  Start with all of them, to catch anything written before
+  // the watches were in place.
+  BOOL dirty[N_IFFS];
+  for (int i = 0; i < N_IFFS; i++) {
+    dirty[i] = TRUE;
   }
-}
 
-float volumes[10] = {
-                     0.026, // 0
-                     0.039, // 1
-                     0.059, // 2
-                     0.088, // 3
-                     0.132, // 4
-                     0.198, // 5
-                     0.296, // 6
-                     0.444, // 7
-                     0.667, // 8
-                     1.000, // 9
-};
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  while (1) {
+    BOOL pending = FALSE;
+    for (int i = 0; i < N_IFFS; i++) {
+      if (dirty[i]) {
+        dirty[i] = !update_iff(iffs[i], TRUE);
+        pending = pending || dirty[i];
+      }
+    }
 
-struct int_from_file {
-  const char* purpose;
-  const char* fname;
-  FILE* file;
-  int value;
-};
+    struct pollfd pfd = {fd, POLLIN, 0};
+    // Normally wait forever, but if the command queue was full, retry soon.
+    if (poll(&pfd, 1, pending ? 50 : -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      break;
+    }
+    if (!(pfd.revents & POLLIN)) {
+      continue;
+    }
 
-struct int_from_file voice_iff;
-struct int_from_file volume_iff;
-struct int_from_file gate_iff;
-float gain;
-float ungain;
-float gate_squared;
-
-#define V_SOPRANO_RECORDER 1
-#define V_BASS_FLUTE 2
-#define V_DIST 3
-#define V_REED 4
-#define V_FLUTE 5
-#define V_EBASS 6
-#define V_VOCAL_2 7
-#define V_VOCAL_1 8
-#define V_RAW 9
-#define V_RAWDIST 0
-
-#define N_OSCS_PER_LAYER 6
-#define N_OSCS (N_OSCS_PER_LAYER*DURATION)
-struct Osc oscs[N_OSCS];
-
-#define ALPHA_HIGH (0.1)
-#define ALPHA_MEDIUM (0.03)
-#define ALPHA_LOW (0.01)
-
-float sine_decimal(float v) {
-  return sin((v+0.5)*M_PI*2);
+    ssize_t len = read(fd, buf, sizeof(buf));
+    for (char* p = buf; len > 0 && p < buf + len;
+         p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+      const struct inotify_event* event = (const struct inotify_event*) p;
+      for (int i = 0; i < N_IFFS; i++) {
+        if (event->len && strcmp(event->name, basenames[i]) == 0) {
+          dirty[i] = TRUE;
+          if (event->mask & IN_MOVED_TO) {
+            // Our open handle still points at the old file.
+            fclose(iffs[i]->file);
+            open_iff_or_die(iffs[i]);
+          }
+        }
+      }
+    }
+  }
+  close(fd);
 }
+#endif
 
-float clip(float v) {
-  return fmaxf(-1, fminf(1, v));
-}
+void* update_iffs(void* ignored) {
+  for (int i = 0; i < N_IFFS; i++) {
+    open_iff_or_die(iffs[i]);
+  }
 
-float atan_decimal(float v) {
-  return atanf(v) / (M_PI/2);
+#ifdef __linux__
+  watch_iffs();
+#endif
+  poll_iffs();
+  return NULL;
 }
 
-#define SAT_1 1
-#define SAT_2 1
-#define SAT_4 1
-#define SAT_8 1
-#define SAT_BIAS 0.5
-
-float saturate(float v) {
-  if (voice_iff.value != V_DIST &&
-      voice_iff.value != V_RAWDIST) {
-    return clip(v);
-  }
-
-  float c = sine_decimal(atan_decimal(v * 4));
-  v += (SAT_1 * c);
-  v += (SAT_2 * c*c);
-  v += (SAT_4 * c*c*c*c);
-  v += (SAT_8 * c*c*c*c*c*c*c);
-  v -= SAT_BIAS;
-  v *= 0.55;
-  return atan_decimal(v/4);
+// OSC control, as an alternative to writing files:
+//
+//   /voice i, /volume i, /gate i    same as the current-* files
+//   /1/voice i, /1/volume i, ...    the same for whistler 1, and so on
+//   /gain if, /speed if,            scale a voice's gain, or its oscillators'
+//   /cycle if, /vol if              speed, cycle, or vol, by a multiplier
+//   /delay/bpm f                    the delay's tempo
+//   /delay/repeats i                how many times the delay repeats
+//   /delay/volume f                 the delay's volume, as a multiplier
+//   /delay/tap                      tap tempo for the delay
+//
+// Ints may also be sent as floats, since many OSC controllers only send
+// floats.
+int osc_arg_int(const char* types, lo_arg** argv, int i) {
+  return types[i] == 'i' ? argv[i]->i : (int) argv[i]->f;
 }
 
-void init_oscs(float adjustment) {
-  long long cycles = octaver.cycles;
-  long long offset = (cycles % DURATION) * N_OSCS_PER_LAYER;
-
-  if (voice_iff.value == V_SOPRANO_RECORDER) {
-    gain = 0.2;
-    ungain = 1;
-    osc_init(&oscs[offset+0],
-	     cycles,
-	     adjustment,
-	     /*vol=*/  0.5,
-	     /*mode=*/ OSC_NAT,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ TRUE,
-	     /*speed=*/ 0.5,
-	     /*cycle=*/ 1,
-	     /*mod=*/ 2);
-  } else if (voice_iff.value == V_BASS_FLUTE) {
-    gain = 0.3;
-    ungain = 1;
-    int cycle_base = 4;
-    osc_init(&oscs[offset+0],
-	     cycles,
-	     adjustment,
-	     /*vol=*/  0.5,
-	     /*mode=*/ OSC_SIN,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ TRUE,
-	     /*speed=*/ 1.0/cycle_base,
-	     /*cycle=*/ 1.0/cycle_base,
-	     /*mod=*/ 2);
-    osc_init(&oscs[offset+1],
-	     cycles,
-	     adjustment,
-	     /*vol=*/  0.2,
-	     /*mode=*/ OSC_SIN,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ TRUE,
-	     /*speed=*/ 2.0/cycle_base,
-	     /*cycle=*/ 2.0/cycle_base,
-	     /*mod=*/ 2);
-    osc_init(&oscs[offset+2],
-	     cycles,
-	     adjustment,
-	     /*vol=*/  0.2,
-	     /*mode=*/ OSC_SIN,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ TRUE,
-	     /*speed=*/ 3.0/cycle_base,
-	     /*cycle=*/ 3.0/cycle_base,
-	     /*mod=*/ 2);
-  } else if (voice_iff.value == V_DIST) {
-    gain = 0.125;
-    ungain = 1;
-    osc_init(&oscs[offset+0],
-	     cycles,
-	     adjustment,
-	     /*vol=*/ 0.5,
-	     /*mode=*/ OSC_SQR,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ TRUE,
-	     /*speed=*/ 0.5,
-	     /*cycle=*/ 1,
-	     /*mod=*/ 2);
-  } else if (voice_iff.value == V_REED) {
-    gain = 0.3;
-    ungain = 1;
-    int cycle_base = 4;
-    osc_init(&oscs[offset+0],
-	     cycles,
-	     adjustment,
-	     /*vol=*/  0.5,
-	     /*mode=*/ OSC_NAT,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ TRUE,
-	     /*speed=*/ 0.25,
-	     /*cycle=*/ 1.0/cycle_base,
-	     /*mod=*/ 2);
-  } else if (voice_iff.value == V_FLUTE) {
-    gain = 0.3;
-    ungain = 1;
-    int cycle_base = 2;
-    osc_init(&oscs[offset+0],
-	     cycles,
-	     adjustment,
-	     /*vol=*/  0.5,
-	     /*mode=*/ OSC_SIN,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ TRUE,
-	     /*speed=*/ 0.5,
-	     /*cycle=*/ 1.0/cycle_base,
-	     /*mod=*/ 2);
-    osc_init(&oscs[offset+1],
-	     cycles,
-	     adjustment,
-	     /*vol=*/  0.15,
-	     /*mode=*/ OSC_SIN,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ TRUE,
-	     /*speed=*/ 0.53,
-	     /*cycle=*/ 2.0/cycle_base,
-	     /*mod=*/ 2);
-    osc_init(&oscs[offset+2],
-	     cycles,
-	     adjustment,
-	     /*vol=*/  0.15,
-	     /*mode=*/ OSC_SIN,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ TRUE,
-	     /*speed=*/ 0.48,
-	     /*cycle=*/ 2.0/cycle_base,
-	     /*mod=*/ 2);
-    osc_init(&oscs[offset+3],
-	     cycles,
-	     adjustment,
-	     /*vol=*/  0.15,
-	     /*mode=*/ OSC_SIN,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ TRUE,
-	     /*speed=*/ 0.51,
-	     /*cycle=*/ 3.0/cycle_base,
-	     /*mod=*/ 2);
-    osc_init(&oscs[offset+4],
-	     cycles,
-	     adjustment,
-	     /*vol=*/  0.15,
-	     /*mode=*/ OSC_SIN,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ TRUE,
-	     /*speed=*/ 0.49,
-	     /*cycle=*/ 3.0/cycle_base,
-	     /*mod=*/ 2);
-  } else if (voice_iff.value == V_VOCAL_2) {
-    gain = 0.25;
-    ungain = 0.5;
-    osc_init(&oscs[offset+0],
-	     cycles,
-	     adjustment,
-	     /*vol=*/ 0.4,
-	     /*mode=*/ OSC_NAT,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ TRUE,
-	     /*speed=*/ 0.5,
-	     /*cycle=*/ 0.5,
-	     /*mod=*/ 2);
-  } else if (voice_iff.value == V_VOCAL_1) {
-    gain = 0.09;
-    ungain = 1;
-    osc_init(&oscs[offset+0],
-	     cycles,
-	     adjustment,
-	     /*vol=*/ 0.4,
-	     /*mode=*/ OSC_NAT,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ TRUE,
-	     /*speed=*/ 0.5,
-	     /*cycle=*/ 1,
-	     /*mod=*/ 2);
-  } else if (voice_iff.value == V_EBASS) {
-    gain = 0.25;
-    ungain = 1;
-    int speed_base = 32;
-    int cycle_base = 16;
-    osc_init(&oscs[offset+0],
-	     cycles,
-	     adjustment,
-	     /*vol=*/ 0.2,
-	     /*mode=*/ OSC_SIN,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ FALSE,
-	     /*speed=*/ 1.0/speed_base,
-	     /*cycle=*/ 8.0/cycle_base,
-	     /*mod=*/ 2);
-    osc_init(&oscs[offset+1],
-	     cycles,
-	     adjustment,
-	     /*vol=*/ 0.24,
-	     /*mode=*/ OSC_SIN,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ FALSE,
-	     /*speed=*/ 2.0/speed_base,
-	     /*cycle=*/ 2.0/cycle_base,
-	     /*mod=*/ 2);
-    osc_init(&oscs[offset+2],
-	     cycles,
-	     adjustment,
-	     /*vol=*/ 0.14,
-	     /*mode=*/ OSC_SIN,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ FALSE,
-	     /*speed=*/ 3.11/speed_base,
-	     /*cycle=*/ 3.0/cycle_base,
-	     /*mod=*/ 2);
-    osc_init(&oscs[offset+3],
-	     cycles,
-	     adjustment,
-	     /*vol=*/ 0.14,
-	     /*mode=*/ OSC_SIN,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ FALSE,
-	     /*speed=*/ 4.3/speed_base,
-	     /*cycle=*/ 4.0/cycle_base,
-	     /*mod=*/ 2);
-    osc_init(&oscs[offset+4],
-	     cycles,
-	     adjustment,
-	     /*vol=*/ 0.06,
-	     /*mode=*/ OSC_SIN,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ FALSE,
-	     /*speed=*/ 5.7/speed_base,
-	     /*cycle=*/ 5.0/cycle_base,
-	     /*mod=*/ 2);
-    osc_init(&oscs[offset+5],
-	     cycles,
-	     adjustment,
-	     /*vol=*/ 0.06,
-	     /*mode=*/ OSC_SIN,
-	     /*lfo_rate=*/ 0,
-	     /*lfo_amplitude=*/ 0,
-	     /*lfo_is_volume*/ FALSE,
-	     /*speed=*/ 6.1/speed_base,
-	     /*cycle=*/ 6.0/cycle_base,
-	     /*mod=*/ 2);
+// Which whistler and command each /voice, /volume, and /gate path is for.
+struct ParamPath {
+  char path[16];
+  int whistler;
+  int type;
+};
+struct ParamPath param_paths[MAX_WHISTLERS * 3];
+
+int osc_param_handler(const char* path, const char* types, lo_arg** argv,
+                      int argc, lo_message msg, void* user_data) {
+  const struct ParamPath* param = user_data;
+  int type = param->type;
+  int value = osc_arg_int(types, argv, 0);
+  if (!param_in_range(type, value)) {
+    printf("%s: %d out of range\n", path, value);
+  } else if (!queue_command(param->whistler, type, value, 0)) {
+    printf("%s: command queue full\n", path);
+  } else {
+    printf("%s: %d\n", path, value);
   }
+  return 0;
 }
 
-float osc_next(struct Osc* osc) {
-  if (!osc->active) {
-    return 0;
+int osc_tweak_handler(const char* path, const char* types, lo_arg** argv,
+                      int argc, lo_message msg, void* user_data) {
+  int type = (int)(intptr_t) user_data;
+  int tweak_voice = osc_arg_int(types, argv, 0);
+  float amount = argv[1]->f;
+  if (tweak_voice < 0 || tweak_voice >= N_VOICES || !isfinite(amount)) {
+    printf("%s: bad arguments\n", path);
+  } else if (!queue_command(0, type, tweak_voice, amount)) {
+    printf("%s: command queue full\n", path);
+  } else {
+    printf("%s: voice %d x%.3f\n", path, tweak_voice, amount);
   }
+  return 0;
+}
 
-  osc->samples++;
+int osc_supersaw_handler(const char* path, const char* types, lo_arg** argv,
+                         int argc, lo_message msg, void* user_data) {
+  int type = (int)(intptr_t) user_data;
+  int saw_voice = osc_arg_int(types, argv, 0);
+  float amount = argv[1]->f;
+  BOOL ok;
+  if (type == CMD_SUPERSAW_SAWS) {
+    ok = amount >= 1 && amount <= SUPERSAW_MAX_SAWS && (int)amount % 2 == 1;
+    amount = (int)amount;
+  } else if (type == CMD_SUPERSAW_DETUNE) {
+    ok = amount >= 0 && amount <= 1200;
+  } else if (type == CMD_SUPERSAW_OCTAVES) {
+    ok = amount >= 0 && amount <= SUPERSAW_MAX_OCTAVES;
+    amount = (int)amount;
+  } else if (type == CMD_SUPERSAW_SMOOTH) {
+    ok = amount > 0 && amount <= 1;
+  } else {
+    ok = amount >= 0 && amount <= 10000;  // ms
+  }
+  if (saw_voice < 0 || saw_voice >= N_VOICES ||
+      !voices[saw_voice].supersaw.saws) {
+    printf("%s: voice %d is not a supersaw\n", path, saw_voice);
+  } else if (!ok) {
+    printf("%s: %.3f out of range\n", path, amount);
+  } else if (!queue_command(0, type, saw_voice, amount)) {
+    printf("%s: command queue full\n", path);
+  } else {
+    printf("%s: voice %d %.3f\n", path, saw_voice, amount);
+  }
+  return 0;
+}
 
-  if (osc->duration > 0) {
-    osc->amp += 0.01 * (1 - osc->amp);
+int osc_delay_handler(const char* path, const char* types, lo_arg** argv,
+                      int argc, lo_message msg, void* user_data) {
+  int type = (int)(intptr_t) user_data;
+  float amount = types[0] == 'i' ? argv[0]->i : argv[0]->f;
+  BOOL ok;
+  if (type == CMD_DELAY_BPM) {
+    ok = amount >= DELAY_MIN_BPM && amount <= DELAY_MAX_BPM;
+  } else if (type == CMD_DELAY_REPEATS) {
+    ok = amount >= 1 && amount <= DELAY_MAX_REPEATS;
+  } else {
+    ok = amount >= 0 && amount <= 10;
+  }
+  if (!ok) {
+    printf("%s: %.3f out of range\n", path, amount);
+  } else if (!queue_command(0, type, (int) amount, amount)) {
+    printf("%s: command queue full\n", path);
   } else {
-    osc->amp *= 0.95;
+    printf("%s: %.3f\n", path, amount);
   }
+  return 0;
+}
 
-  float valA = get_hist((int)osc->pos);
-  float valB = get_hist((int)(osc->pos+1));
-  float amtA = osc->pos - (int)osc->pos;
-  float amtB = 1-amtA;
+// Tap tempo: the tempo is the average of the last few gaps between taps.  A
+// gap too long to be a beat at DELAY_MIN_BPM starts over.
+#define TAP_HISTORY (4)
+double tap_times[TAP_HISTORY];
+int n_taps = 0;
 
-  float val = valA*amtA + valB*amtB;
-  osc->total_amplitude += fabsf(val);
-  if (osc->mode != OSC_NAT) {
-    if (osc->mode == OSC_SQR) {
-      val = val > 0 ? 1 : -1;
-    } else if (osc->mode == OSC_SIN) {
-      val = sine_decimal(osc->pos / osc->rough_input_period);
-    }
-    val *= (osc->total_amplitude / osc->samples);
+int osc_tap_handler(const char* path, const char* types, lo_arg** argv,
+                    int argc, lo_message msg, void* user_data) {
+  // Controllers that send a value for buttons send 0 on release.
+  if (argc && (types[0] == 'i' ? argv[0]->i : argv[0]->f) == 0) {
+    return 0;
   }
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  double now = ts.tv_sec + ts.tv_nsec / 1e9;
 
-  osc->pos += osc->speed;
-  val = osc->amp * val * osc->polarity * osc->vol;
+  if (n_taps && now - tap_times[(n_taps - 1) % TAP_HISTORY] >
+      60.0 / DELAY_MIN_BPM) {
+    n_taps = 0;
+  }
+  tap_times[n_taps % TAP_HISTORY] = now;
+  n_taps++;
+  if (n_taps < 2) {
+    return 0;
+  }
 
-  if (osc->lfo_amplitude > 0) {
-    //printf("%.2f %.2f\n", osc->lfo_pos, sine_decimal(osc->lfo_pos));
-    float lfo_amount = (sine_decimal(osc->lfo_pos)+1)*osc->lfo_amplitude;
-    if (osc->lfo_is_volume) {
-      val = val*lfo_amount + val*(1-osc->lfo_amplitude);
-    } else {
-      osc->pos += lfo_amount;
-    }
-    osc->lfo_pos += (1/osc->lfo_rate);
+  int gaps = n_taps - 1 < TAP_HISTORY - 1 ? n_taps - 1 : TAP_HISTORY - 1;
+  double first = tap_times[(n_taps - 1 - gaps) % TAP_HISTORY];
+  float bpm = 60 * gaps / (now - first);
+  if (bpm > DELAY_MAX_BPM) {
+    printf("%s: too fast\n", path);
+  } else if (!queue_command(0, CMD_DELAY_BPM, 0, bpm)) {
+    printf("%s: command queue full\n", path);
+  } else {
+    printf("%s: %.1f bpm\n", path, bpm);
   }
-  return val;
+  return 0;
 }
 
-void handle_cycle() {
-  for (int i = 0; i < N_OSCS; i++) {
-    if (oscs[i].active) {
-      if (oscs[i].duration > 0) {
-        oscs[i].duration--;
-      }
-      if (oscs[i].duration < 1 && oscs[i].amp < 0.001) {
-        oscs[i].active = FALSE;
-      }
-    }
-  }
+void osc_error(int num, const char* msg, const char* where) {
+  printf("osc error %d in %s: %s\n", num, where ? where : "?", msg);
 }
 
-u_int64_t ticks = 0;
-u_int64_t grace_ticks = 0;
-float update(float s) {
-  if (voice_iff.value == V_RAW || voice_iff.value == V_RAWDIST) {
-    return s * gain;
-  }
-
-  set_hist(s);
-  update_duration(s);
-
-  // To avoid drift, recompute history every 10s.
-  if ((++ticks) % 441000 == 0) {
-    //printf("%lld volume: %.12f -- %.12f\n", ticks, hist_squared_sum(), octaver.hist_sq/HISTORY_LENGTH);
-    octaver.hist_sq = hist_squared_sum();
-  }
-  if (octaver.hist_pos == HISTORY_LENGTH-1) {
-    //printf("recent: %.12f -- %.12f\n", recent_hist_squared_sum(), octaver.recent_hist_sq/RECENT_LENGTH);
-    octaver.recent_hist_sq = recent_hist_squared_sum();
-  }
-
-  octaver.samples_since_last_crossing++;
-  octaver.samples_since_attack_began++;
-
-  int range_high = WHISTLE_RANGE_HIGH;
-  int range_low = WHISTLE_RANGE_LOW;
-  if (voice_iff.value == V_VOCAL_2 || voice_iff.value == V_VOCAL_1) {
-    range_high = VOCAL_RANGE_HIGH;
-    range_low = VOCAL_RANGE_LOW;
-  }
-
-  if (octaver.positive) {
-    if (s < 0) {
-      /*
-       * Let's say we take samples at p and n:
-       *
-       *  p
-       *   \
-       *    \
-       *  -------
-       *      \
-       *       n
-       *
-       * we could say the zero crossing is at n, but better would be to say
-       * it's between p and n in proportion to how far each is from zero.  So,
-       * if n is the current sample, that's:
-       *
-       *        |n|
-       *   - ---------
-       *     |n| + |p|
-       *
-       * But p is always positive and n is always negative, so really:
-       *
-       *        |n|            -n         n
-       *   - ---------  =  - ------  =  -----
-       *     |n| + |p|       -n + p     p - n
-       */
-      float first_negative = s;
-      float last_positive = octaver.previous_sample;
-      float adjustment = first_negative / (last_positive - first_negative);
-      if (isnan(adjustment)) {
-        adjustment = 0;
-      }
-      octaver.samples_since_last_crossing -= adjustment;
-      octaver.rough_input_period = octaver.samples_since_last_crossing;
+void start_osc_server(const char* port, int n_whistlers) {
+  lo_server_thread st = lo_server_thread_new(port, osc_error);
+  if (!st) {
+    printf("couldn't start OSC server on port %s\n", port);
+    return;
+  }
 
-      if (octaver.rough_input_period > range_high &&
-          octaver.rough_input_period < range_low) {
-        init_oscs(adjustment);
+  const char* param_names[] = {"voice", "volume", "gate"};
+  int param_commands[] = {CMD_VOICE, CMD_VOLUME, CMD_GATE};
+  for (int w = 0; w < n_whistlers; w++) {
+    for (int i = 0; i < 3; i++) {
+      struct ParamPath* param = &param_paths[w*3 + i];
+      if (w == 0) {
+        snprintf(param->path, sizeof(param->path), "/%s", param_names[i]);
+      } else {
+        snprintf(param->path, sizeof(param->path), "/%d/%s",
+                 w, param_names[i]);
       }
-
-      octaver.cycles++;
-      handle_cycle();
-
-      octaver.positive = FALSE;
-      octaver.samples_since_last_crossing = -adjustment;
-    }
-  } else {
-    if (s > 0) {
-      octaver.positive = TRUE;
+      param->whistler = w;
+      param->type = param_commands[i];
+      lo_server_thread_add_method(st, param->path, "i",
+                                  osc_param_handler, param);
+      lo_server_thread_add_method(st, param->path, "f",
+                                  osc_param_handler, param);
     }
   }
 
-  octaver.previous_sample = s;
+  const char* tweak_paths[N_TWEAKS] = {"/gain", "/speed", "/cycle", "/vol"};
+  for (int i = 0; i < N_TWEAKS; i++) {
+    void* command = (void*)(intptr_t)(CMD_TWEAK_GAIN + i);
+    lo_server_thread_add_method(st, tweak_paths[i], "if",
+                                osc_tweak_handler, command);
+    lo_server_thread_add_method(st, tweak_paths[i], "ff",
+                                osc_tweak_handler, command);
+  }
 
-  float val = 0;
-  for (int i = 0 ; i < N_OSCS; i++) {
-    val += osc_next(&oscs[i]);
+  const char* supersaw_paths[] = {
+    "/supersaw/saws", "/supersaw/detune", "/supersaw/octaves",
+    "/supersaw/attack", "/supersaw/release", "/supersaw/smooth"};
+  for (int i = 0; i < 6; i++) {
+    void* command = (void*)(intptr_t)(CMD_SUPERSAW_SAWS + i);
+    lo_server_thread_add_method(st, supersaw_paths[i], "if",
+                                osc_supersaw_handler, command);
+    lo_server_thread_add_method(st, supersaw_paths[i], "ff",
+                                osc_supersaw_handler, command);
   }
 
-  if ((octaver.hist_sq/HISTORY_LENGTH <
-       GATE_SQUARED * gate_squared) &&
-      (octaver.recent_hist_sq / RECENT_LENGTH <
-       RECENT_GATE_SQUARED * gate_squared )) {
-//  if (grace_ticks == 0) {
-        val = 0;
-//    } else {
-//      grace_ticks--;
-//  } else {
-//    grace_ticks = GRACE_TICKS;
-//  }
+  const char* delay_paths[] = {"/delay/bpm", "/delay/repeats", "/delay/volume"};
+  int delay_commands[] = {CMD_DELAY_BPM, CMD_DELAY_REPEATS, CMD_DELAY_VOLUME};
+  for (int i = 0; i < 3; i++) {
+    void* command = (void*)(intptr_t) delay_commands[i];
+    lo_server_thread_add_method(st, delay_paths[i], "i",
+                                osc_delay_handler, command);
+    lo_server_thread_add_method(st, delay_paths[i], "f",
+                                osc_delay_handler, command);
   }
+  lo_server_thread_add_method(st, "/delay/tap", "", osc_tap_handler, NULL);
+  lo_server_thread_add_method(st, "/delay/tap", "i", osc_tap_handler, NULL);
+  lo_server_thread_add_method(st, "/delay/tap", "f", osc_tap_handler, NULL);
 
-  return val * GAIN * gain;
+  lo_server_thread_start(st);
+  printf("listening for OSC on UDP port %d\n", lo_server_thread_get_port(st));
 }
 
-float bpm_to_samples(float bpm) {
-  float bps = bpm/60;
-  return SAMPLE_RATE / bps;
+// Passing on what the octavers hear, so whistles can drive other synths.
+// The audio thread publishes events; this thread drains them every couple of
+// ms and sends them on, as OSC:
+//
+//   /onset f       the gate opened; amplitude
+//   /pitch ff      frequency in Hz, amplitude
+//   /offset        the gate closed
+//
+// prefixed with /1, /2, ... for whistlers after the first, and as MIDI,
+// written raw to a device like /dev/snd/midiC1D0: one note at a time per
+// whistler, on channel 1 for the first and so on, following the pitch with
+// bends, and starting a new note when the pitch moves further than the bend
+// range.
+#define EVENT_POLL_US (2000)
+#define BEND_RANGE (2)  // semitones, the usual default for receivers
+
+lo_address events_osc = NULL;
+int events_midi_fd = -1;
+int events_whistlers = 1;
+int midi_note[MAX_WHISTLERS];  // sounding, or -1
+int midi_bend[MAX_WHISTLERS];
+
+void write_midi(const unsigned char* bytes, int n) {
+  if (write(events_midi_fd, bytes, n) != n) {
+    perror("midi out");
+  }
 }
 
-float delay_tempo_bpm = 118.5;
-int delay_repeats = 3;
-float delay_volume = 1;
-#define DELAY_HISTORY_LENGTH (SAMPLE_RATE*90*10)
-float delay_history[DELAY_HISTORY_LENGTH];
-uint64_t delay_write_pos = 0;
+void midi_note_off(int w) {
+  if (midi_note[w] >= 0) {
+    unsigned char off[] = {0x80 | w, midi_note[w], 0};
+    write_midi(off, sizeof(off));
+    midi_note[w] = -1;
+  }
+}
 
-float delay_update(float sample) {
-   uint64_t write_pos = delay_write_pos % DELAY_HISTORY_LENGTH;
-   delay_history[write_pos] = sample;
+void midi_pitch(int w, float hz, float amplitude) {
+  float note = 69 + 12 * log2f(hz / 440);
+  if (note < 0 || note > 127) {
+    return;
+  }
+  if (midi_note[w] < 0 || fabsf(note - midi_note[w]) > BEND_RANGE) {
+    midi_note_off(w);
+    midi_note[w] = (int) roundf(note);
+    int velocity = 1 + (int)(126 * fminf(1, amplitude * 4));
+    unsigned char on[] = {0x90 | w, midi_note[w], velocity};
+    write_midi(on, sizeof(on));
+  }
+  int bend = 8192 + (int)((note - midi_note[w]) / BEND_RANGE * 8191);
+  if (bend != midi_bend[w]) {
+    unsigned char msg[] = {0xe0 | w, bend & 0x7f, (bend >> 7) & 0x7f};
+    write_midi(msg, sizeof(msg));
+    midi_bend[w] = bend;
+  }
+}
 
-   float sample_out = 0;
+void send_osc_event(int w, const char* name, const struct Event* event) {
+  char path[16];
+  if (w == 0) {
+    snprintf(path, sizeof(path), "/%s", name);
+  } else {
+    snprintf(path, sizeof(path), "/%d/%s", w, name);
+  }
+  if (event->type == EVENT_PITCH) {
+    lo_send(events_osc, path, "ff",
+            synth_sample_rate() / event->period, event->amplitude);
+  } else if (event->type == EVENT_ONSET) {
+    lo_send(events_osc, path, "f", event->amplitude);
+  } else {
+    lo_send(events_osc, path, "");
+  }
+}
 
-   float repeat_delta_samples = bpm_to_samples(delay_tempo_bpm);
-   for (int repeat = 1; repeat <= delay_repeats; repeat++) {
-      float repeat_pos = write_pos - (repeat_delta_samples*repeat);
-      if (repeat_pos < 0) {
-         repeat_pos += DELAY_HISTORY_LENGTH;
+void* send_events(void* ignored) {
+  const char* names[] = {"onset", "offset", "pitch"};
+  struct Event event;
+  while (1) {
+    for (int w = 0; w < events_whistlers; w++) {
+      while (next_event(w, &event)) {
+        if (events_osc) {
+          send_osc_event(w, names[event.type], &event);
+        }
+        if (events_midi_fd < 0) {
+          continue;
+        }
+        if (event.type == EVENT_PITCH) {
+          midi_pitch(w, synth_sample_rate() / event.period, event.amplitude);
+        } else if (event.type == EVENT_OFFSET) {
+          midi_note_off(w);
+        }
       }
+    }
+    usleep(EVENT_POLL_US);
+  }
+  return NULL;
+}
 
-      int repeat_A_pos = (int)repeat_pos;
-      int repeat_B_pos = repeat_A_pos + 1;
-
-      float repeat_A_frac = 1 - (repeat_pos - repeat_A_pos);
-
-      float sample_A = delay_history[repeat_A_pos];
-      // We added one to repeat_A_pos above, so it could be past the
-      // end of delay_history.
-      float sample_B = delay_history[repeat_B_pos % DELAY_HISTORY_LENGTH];
+// Sends events to host:port over OSC and to midi_path, either of which may
+// be NULL.  Returns FALSE, after printing why, if either can't be opened.
+BOOL start_events_thread(const char* osc_target, const char* midi_path,
+                         int n_whistlers) {
+  if (!osc_target && !midi_path) {
+    return TRUE;
+  }
+  events_whistlers = n_whistlers;
+  for (int w = 0; w < MAX_WHISTLERS; w++) {
+    midi_note[w] = -1;
+    midi_bend[w] = -1;
+  }
+  if (osc_target) {
+    char* host = strdup(osc_target);
+    char* colon = strrchr(host, ':');
+    if (!colon) {
+      printf("--events-osc wants host:port, not %s\n", osc_target);
+      free(host);
+      return FALSE;
+    }
+    *colon = '\0';
+    events_osc = lo_address_new(host, colon + 1);
+    free(host);
+    if (!events_osc) {
+      printf("can't send OSC to %s\n", osc_target);
+      return FALSE;
+    }
+  }
+  if (midi_path) {
+    events_midi_fd = open(midi_path, O_WRONLY | O_CLOEXEC);
+    if (events_midi_fd < 0) {
+      perror("can't open MIDI output");
+      return FALSE;
+    }
+  }
+  pthread_t events_thread;
+  pthread_create(&events_thread, NULL, &send_events, NULL);
+  return TRUE;
+}
 
-      sample_out += (sample_A * repeat_A_frac) + (sample_B * (1-repeat_A_frac));
-   }
+pthread_t iff_thread;
+void start_iff_thread() {
+  pthread_create(&iff_thread, NULL, &update_iffs, NULL);
+}
 
-   delay_write_pos++;
-   return sample_out * delay_volume / delay_repeats;
+// The callback engine runs process_frames() directly on PortAudio's audio
+// thread instead of looping over blocking reads and writes on ours.  That
+// saves a buffer of latency, and lets us put the audio thread at real-time
+// priority.  Nothing in the callback may block, allocate, or print, so it
+// just counts problems and the main thread reports them.
+#define RT_PRIORITY (70)
+
+volatile int rt_status = 0;  // 0: not tried yet, 1: SCHED_FIFO, else -errno
+volatile unsigned int input_overflows = 0;
+volatile unsigned int output_underflows = 0;
+
+void set_rt_priority() {
+  struct sched_param param;
+  param.sched_priority = RT_PRIORITY;
+  int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  rt_status = err ? -err : 1;
 }
 
+int audio_callback(const void* input, void* output,
+                   unsigned long frames,
+                   const PaStreamCallbackTimeInfo* timeInfo,
+                   PaStreamCallbackFlags statusFlags,
+                   void* userData) {
+  if (!rt_status) {
+    set_rt_priority();
+  }
+  if (statusFlags & paInputOverflow) {
+    input_overflows++;
+  }
+  if (statusFlags & paOutputUnderflow) {
+    output_underflows++;
+  }
+  process_frames((const float*) input, (float*) output, frames);
+  return paContinue;
+}
 
+// Keep everything we'll touch from the audio thread in RAM, so it never
+// waits on a page fault.
+void lock_memory() {
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    perror("mlockall failed, continuing without locked memory");
+  }
+}
 
-int read_number(FILE* file) {
-  char buf[16];
-  rewind(file);
-  int bytesRead = fread(buf, 1, 16, file);
-  if (bytesRead > 15) {
-    bytesRead = 15;
+// How many frames each PortAudio buffer holds.  process_frames() takes any
+// number, so this needn't be FRAMES_PER_BUFFER; read_frames_file() takes it
+// from a file --calibrate wrote, in which case we also ask for no more
+// latency than one buffer.
+int frames_per_buffer = FRAMES_PER_BUFFER;
+BOOL frames_calibrated = FALSE;
+
+// Returns FALSE, after printing why, if fname holds something other than a
+// buffer size.  A missing file is fine: it just hasn't been calibrated.
+BOOL read_frames_file(const char* fname) {
+  FILE* file = fopen(fname, "r");
+  if (!file) {
+    return TRUE;
   }
-  buf[bytesRead] = '\0';
-  return atoi(buf);
+  int frames = read_number(file);
+  fclose(file);
+  if (frames < 1 || frames > 8192) {
+    printf("%s should hold a buffer size, like 64\n", fname);
+    return FALSE;
+  }
+  frames_per_buffer = frames;
+  frames_calibrated = TRUE;
+  return TRUE;
 }
 
-void open_iff_or_die(struct int_from_file* iff) {
-  iff->file = fopen(iff->fname, "r");
-  if (!iff->file) {
-    perror("can't open file");
-    fprintf(stderr, "  in: %s", iff->fname);
-    exit(-1);
+PaError wait_for_callback_stream(PaStream* stream) {
+  int reported_rt_status = 0;
+  unsigned int reported_input_overflows = 0;
+  unsigned int reported_output_underflows = 0;
+  PaError active;
+  while ((active = Pa_IsStreamActive(stream)) == 1) {
+    Pa_Sleep(1000);
+    if (rt_status != reported_rt_status) {
+      reported_rt_status = rt_status;
+      if (reported_rt_status == 1) {
+        printf("audio thread running SCHED_FIFO at priority %d\n",
+               RT_PRIORITY);
+      } else {
+        printf("couldn't make audio thread real-time: %s\n",
+               strerror(-reported_rt_status));
+      }
+    }
+    if (input_overflows != reported_input_overflows ||
+        output_underflows != reported_output_underflows) {
+      reported_input_overflows = input_overflows;
+      reported_output_underflows = output_underflows;
+      printf("xruns: %u input overflows, %u output underflows\n",
+             reported_input_overflows, reported_output_underflows);
+    }
   }
-  return;
+  return active;
 }
 
-void init_gains() {
-  if (voice_iff.value == V_RAW) {
-    gain = 0.125;
-    ungain = 0.7;
-  } else if (voice_iff.value == V_RAWDIST) {
-    gain = 0.5;
-    ungain = 0.25;
-  } else {
-    gain = 0.25;
-    ungain = 1;
+// Calibration finds the smallest buffer this rig can keep up with.  It
+// opens the stream at each of calibration_sizes in turn, largest first, and
+// runs the callback engine for CALIBRATE_SECONDS on each, with a whistle
+// sweep in place of the input, through every voice in turn, so the load is
+// what it would be while playing.  Output is silent.  A size is stable if
+// there were no xruns and 99% of blocks took at most CALIBRATE_MAX_LOAD of
+// their deadline, leaving room for whatever else the machine is doing.  We
+// stop at the first size that isn't, and keep the one before it.
+#define CALIBRATE_SECONDS (4)
+#define CALIBRATE_WARMUP_MS (500)  // not measured: streams often xrun on start
+#define CALIBRATE_MAX_LOAD (70)  // percent
+#define CALIBRATE_MAX_FRAMES (256)
+#define CALIBRATE_AMPLITUDE (0.3)
+
+int calibration_sizes[] = {256, 128, 64, 32, 16};
+#define N_CALIBRATION_SIZES (sizeof(calibration_sizes) / sizeof(int))
+
+float calibration_in[CALIBRATE_MAX_FRAMES * (MAX_WHISTLERS + 1)];
+float calibration_out[CALIBRATE_MAX_FRAMES * (MAX_WHISTLERS + 1)];
+double calibration_phase = 0;
+unsigned long calibration_frame = 0;
+
+// Only touched by the callback while measuring, and by the main thread once
+// the stream has stopped.
+volatile BOOL calibration_measuring = FALSE;
+unsigned int calibration_xruns = 0;
+unsigned int calibration_blocks = 0;
+unsigned int calibration_load[CALIBRATE_MAX_LOAD + 2];  // by percent; last: over
+double calibration_max_load = 0;
+
+// A whistle sweeping from 700Hz up to 2800Hz and back every two seconds, on
+// every channel.
+void make_calibration_input(int frames, int channels) {
+  float rate = synth_sample_rate();
+  for (int i = 0; i < frames; i++) {
+    float t = fmodf(calibration_frame++ / rate, 2) - 1;
+    float hz = 700 * exp2f(2 * (1 - fabsf(t)));
+    calibration_phase += 2 * M_PI * hz / rate;
+    if (calibration_phase > 2 * M_PI) {
+      calibration_phase -= 2 * M_PI;
+    }
+    float sample = CALIBRATE_AMPLITUDE * sin(calibration_phase);
+    for (int c = 0; c < channels; c++) {
+      calibration_in[i*channels + c] = sample;
+    }
   }
 }
 
-void init_gate() {
-  gate_squared = ((volumes[9-gate_iff.value] / volumes[5]) *
-                  (volumes[9-gate_iff.value] / volumes[5]));
+double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
 }
 
-void update_iff(struct int_from_file* iff) {
-  rewind(iff->file);
-  int new_value = read_number(iff->file);
-  if (iff->value != new_value) {
-    printf("%s: %d -> %d\n", iff->purpose, iff->value, new_value);
-    iff->value = new_value;
-    init_octaver();
-    init_gains();
-    init_gate();
+int calibration_callback(const void* input, void* output,
+                         unsigned long frames,
+                         const PaStreamCallbackTimeInfo* timeInfo,
+                         PaStreamCallbackFlags statusFlags,
+                         void* userData) {
+  if (!rt_status) {
+    set_rt_priority();
   }
-}
+  int channels = synth_channels();
+  memset(output, 0, frames * channels * sizeof(float));
+
+  double start = now_ns();
+  for (unsigned long done = 0; done < frames; done += CALIBRATE_MAX_FRAMES) {
+    int n = frames - done < CALIBRATE_MAX_FRAMES ?
+      frames - done : CALIBRATE_MAX_FRAMES;
+    make_calibration_input(n, channels);
+    process_frames(calibration_in, calibration_out, n);
+  }
+  double load = 100 * (now_ns() - start) /
+    (1e9 * frames / synth_sample_rate());
 
-void* update_iffs(void* ignored) {
-  open_iff_or_die(&voice_iff);
-  open_iff_or_die(&volume_iff);
-  open_iff_or_die(&gate_iff);
+  if (calibration_measuring) {
+    if (statusFlags & (paInputOverflow | paOutputUnderflow)) {
+      calibration_xruns++;
+    }
+    calibration_blocks++;
+    calibration_load[load > CALIBRATE_MAX_LOAD ?
+                     CALIBRATE_MAX_LOAD + 1 : (int)load]++;
+    if (load > calibration_max_load) {
+      calibration_max_load = load;
+    }
+  }
+  return paContinue;
+}
 
-  while (1) {
-    update_iff(&voice_iff);
-    update_iff(&volume_iff);
-    update_iff(&gate_iff);
-    usleep(50000 /* 50ms in us */);
+// The smallest percent of the deadline that fraction of blocks stayed
+// within, or CALIBRATE_MAX_LOAD + 1 if over.
+int calibration_percentile(double fraction) {
+  unsigned int seen = 0;
+  for (int pct = 0; pct <= CALIBRATE_MAX_LOAD + 1; pct++) {
+    seen += calibration_load[pct];
+    if (seen >= fraction * calibration_blocks) {
+      return pct + 1;
+    }
   }
+  return CALIBRATE_MAX_LOAD + 1;
 }
 
+// Returns whether frames per buffer was stable.
+BOOL calibrate_size(PaStreamParameters* in, PaStreamParameters* out,
+                    int frames, int n_whistlers) {
+  in->suggestedLatency = frames / synth_sample_rate();
+  out->suggestedLatency = frames / synth_sample_rate();
+  PaStream* stream = NULL;
+  PaError err = Pa_OpenStream(&stream, in, out, synth_sample_rate(), frames,
+                              paClipOff, calibration_callback, NULL);
+  if (err == paNoError) {
+    calibration_measuring = FALSE;
+    calibration_xruns = 0;
+    calibration_blocks = 0;
+    memset(calibration_load, 0, sizeof(calibration_load));
+    calibration_max_load = 0;
+    err = Pa_StartStream(stream);
+  }
+  if (err != paNoError) {
+    printf("%6d  can't open: %s\n", frames, Pa_GetErrorText(err));
+    if (stream) {
+      Pa_CloseStream(stream);
+    }
+    return FALSE;
+  }
 
+  Pa_Sleep(CALIBRATE_WARMUP_MS);
+  calibration_measuring = TRUE;
+  int n_voices = 0;
+  for (int v = 0; v < N_VOICES; v++) {
+    n_voices += voices[v].name[0] != 0;
+  }
+  for (int v = 0; v < N_VOICES; v++) {
+    if (!voices[v].name[0]) {
+      continue;
+    }
+    for (int w = 0; w < n_whistlers; w++) {
+      queue_command(w, CMD_VOICE, v, 0);
+    }
+    Pa_Sleep(CALIBRATE_SECONDS * 1000 / n_voices);
+  }
+  Pa_StopStream(stream);
+  Pa_CloseStream(stream);
+
+  int p50 = calibration_percentile(0.5);
+  int p99 = calibration_percentile(0.99);
+  BOOL stable = (calibration_blocks > 0 && calibration_xruns == 0 &&
+                 p99 <= CALIBRATE_MAX_LOAD);
+  printf("%6d %8.2f %6u %7d%% %7d%% %7.0f%%  %s\n",
+         frames, 1000.0 * frames / synth_sample_rate(), calibration_xruns,
+         p50, p99, calibration_max_load, stable ? "stable" : "unstable");
+  return stable;
+}
 
+// Try each size, and write the smallest stable one to fname.
+int calibrate(PaStreamParameters* in, PaStreamParameters* out,
+              int n_whistlers, const char* fname) {
+  lock_memory();
+  printf("calibrating, %ds per size; p99 must be under %d%%\n",
+         CALIBRATE_SECONDS, CALIBRATE_MAX_LOAD);
+  printf("%6s %8s %6s %8s %8s %8s\n",
+         "frames", "ms", "xruns", "p50", "p99", "max");
+  int best = 0;
+  for (int i = 0; i < N_CALIBRATION_SIZES; i++) {
+    if (!calibrate_size(in, out, calibration_sizes[i], n_whistlers)) {
+      break;
+    }
+    best = calibration_sizes[i];
+  }
+  Pa_Terminate();
 
-pthread_t iff_thread;
-void start_iff_thread() {
-  pthread_create(&iff_thread, NULL, &update_iffs, NULL);
+  if (!best) {
+    printf("no size was stable; leaving %s alone\n", fname);
+    return -1;
+  }
+  FILE* file = fopen(fname, "w");
+  if (!file || fprintf(file, "%d\n", best) < 0 || fclose(file) != 0) {
+    perror("can't write buffer size");
+    fprintf(stderr, "  in: %s\n", fname);
+    return -1;
+  }
+  printf("%d frames per buffer, saved to %s\n", best, fname);
+  return 0;
 }
 
-int start_audio(int device_index) {
+// Plays until something goes wrong; or, with calibrate_fname, calibrates
+// the buffer size, saves it there, and returns.
+int start_audio(int device_index, int n_whistlers, BOOL use_callback,
+                const char* calibrate_fname) {
   PaStreamParameters inputParameters;
   PaStreamParameters outputParameters;
   PaStream *stream = NULL;
@@ -866,8 +918,14 @@ int start_audio(int device_index) {
   float *sampleBlockIn = NULL;
   float *sampleBlockOut = NULL;
   int numBytesPerChannel;
+  int channels = synth_channels();
 
-  init_octaver();
+  init_synth();
+  int workers = start_whistler_threads(
+    use_callback || calibrate_fname ? RT_PRIORITY : 0);
+  if (workers) {
+    printf("%d whistlers on worker threads\n", workers);
+  }
 
   err = Pa_Initialize();
   if( err != paNoError ) goto error2;
@@ -911,8 +969,12 @@ int start_audio(int device_index) {
   printf( "     CC: %d\n", inputInfo->maxInputChannels );
   printf( "     SR: %0.2f\n", inputInfo->defaultSampleRate);
   printf( "     LL: %.2fms\n", inputInfo->defaultLowInputLatency*1000 );
+  if (inputInfo->maxInputChannels < channels) {
+    printf("need %d input channels\n", channels);
+    die("not enough channels for the whistlers and the delay");
+  }
 
-  inputParameters.channelCount = 2;  // stereo
+  inputParameters.channelCount = channels;
   inputParameters.sampleFormat = PA_SAMPLE_TYPE;
   inputParameters.suggestedLatency = inputInfo->defaultLowInputLatency ;
   inputParameters.hostApiSpecificStreamInfo = NULL;
@@ -924,85 +986,76 @@ int start_audio(int device_index) {
   printf( "     CC: %d\n", outputInfo->maxOutputChannels );
   printf( "     SR: %0.2f\n", outputInfo->defaultSampleRate);
   printf( "     LL: %.2fms\n", outputInfo->defaultLowOutputLatency * 1000);
-  outputParameters.channelCount = 2;  // stereo
+  outputParameters.channelCount = channels;
   outputParameters.sampleFormat = PA_SAMPLE_TYPE;
   outputParameters.suggestedLatency = outputInfo->defaultLowOutputLatency;
   outputParameters.hostApiSpecificStreamInfo = NULL;
 
+  if (calibrate_fname) {
+    return calibrate(&inputParameters, &outputParameters, n_whistlers,
+                     calibrate_fname);
+  }
+  if (frames_calibrated) {
+    inputParameters.suggestedLatency =
+      frames_per_buffer / synth_sample_rate();
+    outputParameters.suggestedLatency =
+      frames_per_buffer / synth_sample_rate();
+  }
+
   /* -- setup -- */
 
   err = Pa_OpenStream(&stream,
 		      &inputParameters,
 		      &outputParameters,
-		      SAMPLE_RATE,
-		      FRAMES_PER_BUFFER,
+		      synth_sample_rate(),
+		      frames_per_buffer,
 		      paClipOff,      /* we won't output out of range samples so dvon't bother clipping them */
-		      NULL, /* no callback, use blocking API */
-		      NULL ); /* no callback, so no callback userData */
+		      use_callback ? audio_callback : NULL, /* NULL: use blocking API */
+		      NULL ); /* callback has no userData */
   if( err != paNoError ) goto error2;
 
-  numBytesPerChannel = FRAMES_PER_BUFFER * SAMPLE_SIZE ;
-  sampleBlockIn = (float *) malloc( numBytesPerChannel * 2);
-  sampleBlockOut = (float *) malloc( numBytesPerChannel * 2);
+  const PaStreamInfo* streamInfo = Pa_GetStreamInfo(stream);
+  if (streamInfo) {
+    printf("Stream latency: %.2fms in, %.2fms out at %.0fHz, "
+           "%d-frame buffers%s (%s engine)\n",
+           streamInfo->inputLatency * 1000,
+           streamInfo->outputLatency * 1000,
+           streamInfo->sampleRate,
+           frames_per_buffer, frames_calibrated ? ", calibrated" : "",
+           use_callback ? "callback" : "blocking");
+  }
+
+  numBytesPerChannel = frames_per_buffer * SAMPLE_SIZE ;
+  sampleBlockIn = (float *) malloc( numBytesPerChannel * channels);
+  sampleBlockOut = (float *) malloc( numBytesPerChannel * channels);
   if( sampleBlockIn == NULL || sampleBlockOut == NULL) {
     printf("Could not allocate in and out arrays.\n");
     goto error1;
   }
-  memset( sampleBlockIn, SAMPLE_SILENCE, numBytesPerChannel * 2);
-  memset( sampleBlockOut, SAMPLE_SILENCE, numBytesPerChannel * 2);
-
-  err = Pa_StartStream( stream );
-  if( err != paNoError ) goto error1;
+  memset( sampleBlockIn, SAMPLE_SILENCE, numBytesPerChannel * channels);
+  memset( sampleBlockOut, SAMPLE_SILENCE, numBytesPerChannel * channels);
 
-  for (int i = 0; i < N_OSCS; i++) {
-    oscs[i].active = FALSE;
-    oscs[i].lfo_pos = 0;
+  if (use_callback) {
+    lock_memory();
   }
 
-  for (int i = 0; i < DURATION_BLOCKS; i++) {
-    duration_hist[i] = 0;
-  }
+  err = Pa_StartStream( stream );
+  if( err != paNoError ) goto error1;
 
-  for (int i = 0; i < DELAY_HISTORY_LENGTH; i++) {
-     delay_history[i] = 0;
+  if (use_callback) {
+    err = wait_for_callback_stream(stream);
+    goto xrun;
   }
 
-
-  float output = 0;
   while(TRUE) {
-    err = Pa_ReadStream( stream, sampleBlockIn, FRAMES_PER_BUFFER );
+    err = Pa_ReadStream( stream, sampleBlockIn, frames_per_buffer );
     if (err & paInputOverflow) {
       printf("ignoring input undeflow\n");
     } else if( err ) goto xrun;
 
-    float alpha = ALPHA_HIGH;
-    if (voice_iff.value == V_EBASS) {
-      alpha = ALPHA_LOW;
-    }
-
-    for (int i = 0; i < FRAMES_PER_BUFFER; i++) {
-      float sample = sampleBlockIn[i*2];
-      float delay_sample = sampleBlockIn[i*2 + 1];
-      
-      float val = update(sample);
-      float delay_sample_out = delay_update(delay_sample);
-
-      output += alpha * (val - output);
-      float sample_out = output / alpha ; // makeup gain
-
-      // never wrap -- wrapping sounds horrible
-      sample_out = saturate(sample_out);
-      delay_sample_out = saturate(delay_sample_out);
-
-      sample_out *= VOLUME * volumes[volume_iff.value] * ungain;
-      // Ideally this is never hit, but it would be really bad if it wrapped.
-      sample_out = clip(sample_out);
-
-      sampleBlockOut[i*2] = sample_out; 
-      sampleBlockOut[i*2 + 1] = delay_sample_out;      
-    }
+    process_frames(sampleBlockIn, sampleBlockOut, frames_per_buffer);
 
-    err = Pa_WriteStream( stream, sampleBlockOut, FRAMES_PER_BUFFER );
+    err = Pa_WriteStream( stream, sampleBlockOut, frames_per_buffer );
     if (err & paOutputUnderflow) {
       printf("ignoring output undeflow\n");
     } else if( err ) goto xrun;
@@ -1038,22 +1091,107 @@ xrun:
 }
 
 int main(int argc, char** argv) {
+  const char* program = argv[0];
+  BOOL use_callback = FALSE;
+  const char* osc_port = DEFAULT_OSC_PORT;
+  const char* events_osc_target = NULL;
+  const char* events_midi_path = NULL;
+  int n_whistlers = 1;
+  const char* frames_fname = NULL;
+  BOOL calibrate = FALSE;
+  while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+    if (strcmp(argv[1], "--callback") == 0) {
+      use_callback = TRUE;
+    } else if (strcmp(argv[1], "--calibrate") == 0) {
+      calibrate = TRUE;
+    } else if (strcmp(argv[1], "--frames-file") == 0 && argc > 2) {
+      frames_fname = argv[2];
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "--no-delay") == 0) {
+      set_delay_enabled(FALSE);
+    } else if (strcmp(argv[1], "--whistlers") == 0 && argc > 2) {
+      n_whistlers = atoi(argv[2]);
+      if (n_whistlers < 1 || n_whistlers > MAX_WHISTLERS) {
+        printf("--whistlers must be 1-%d\n", MAX_WHISTLERS);
+        return -1;
+      }
+      set_whistlers(n_whistlers);
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "--rate") == 0 && argc > 2) {
+      float rate = atof(argv[2]);
+      if (rate <= 0) {
+        printf("--rate wants a sample rate in Hz, like 96000\n");
+        return -1;
+      }
+      set_sample_rate(rate);
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "--osc-port") == 0 && argc > 2) {
+      osc_port = argv[2];
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "--events-osc") == 0 && argc > 2) {
+      events_osc_target = argv[2];
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "--events-midi") == 0 && argc > 2) {
+      events_midi_path = argv[2];
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "--voices") == 0 && argc > 2) {
+      if (!load_voices(argv[2])) {
+        return -1;
+      }
+      argc--;
+      argv++;
+    } else {
+      argc = 0;  // print usage
+      break;
+    }
+    argc--;
+    argv++;
+  }
   if (argc != 5) {
-    printf("usage: %s /device/index /voice/file /volume/file /gate/file\n",
-           argv[0]);
+    printf("usage: %s [--callback] [--no-delay] [--whistlers n] [--rate hz] [--frames-file file [--calibrate]] [--osc-port port] [--events-osc host:port] [--events-midi device] [--voices file] /device/index /voice/file /volume/file /gate/file\n",
+           program);
+    return -1;
+  }
+  if (calibrate && !frames_fname) {
+    printf("--calibrate needs --frames-file, to save the size it finds\n");
+    return -1;
+  }
+  if (frames_fname && !calibrate && !use_callback) {
+    // A size the callback engine keeps up with says nothing about ours.
+    printf("--frames-file needs --callback, the engine --calibrate measures\n");
+    return -1;
+  }
+  if (frames_fname && !calibrate && !read_frames_file(frames_fname)) {
     return -1;
   }
   int device_index = read_number(fopen(argv[1], "r"));
   voice_iff.purpose = "voice";
   voice_iff.fname = argv[2];
   voice_iff.value = V_EBASS;
+  voice_iff.command = CMD_VOICE;
   volume_iff.purpose = "volume";
   volume_iff.fname = argv[3];
   volume_iff.value = 5;
+  volume_iff.command = CMD_VOLUME;
   gate_iff.purpose = "gate";
   gate_iff.fname = argv[4];
   gate_iff.value = 1;
+  gate_iff.command = CMD_GATE;
 
+  if (calibrate) {
+    return start_audio(device_index, n_whistlers, TRUE, frames_fname);
+  }
+  if (!start_events_thread(events_osc_target, events_midi_path,
+                           n_whistlers)) {
+    return -1;
+  }
   start_iff_thread();
-  return start_audio(device_index);
+  start_osc_server(osc_port, n_whistlers);
+  return start_audio(device_index, n_whistlers, use_callback, NULL);
 }